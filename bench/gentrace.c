@@ -0,0 +1,202 @@
+/*
+ * gentrace.c
+ *	Write the synthetic traces of bench/traces for mdriver. Every workload uses a fixed seed,
+ *	so the traces are the same on every machine and can be regenerated at will.
+ *
+ *	usage: gentrace dir
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static FILE *out = NULL;
+static unsigned long long seed = 0;
+
+// xorshift64*, so the traces do not depend on the rand of the C library
+static unsigned long long next_rand()
+{
+    seed ^= seed>>12;
+    seed ^= seed<<25;
+    seed ^= seed>>27;
+    return seed*2685821657736338717ULL;
+}
+
+// A random number in [lo, hi]
+static size_t rand_between(size_t lo,size_t hi)
+{
+    return lo+(size_t)(next_rand()%(hi-lo+1));
+}
+
+// A random size in [lo, hi] with a log-uniform distribution, so small sizes are as common as in real programs
+static size_t rand_log(size_t lo,size_t hi)
+{
+    size_t bits = 0, top = 0;
+
+    while (((size_t)2<<bits) <= hi)
+        bits++;
+    do
+    {
+        top = (size_t)1<<rand_between(0,bits);
+        top = rand_between(top,top*2-1);
+    } while (top < lo || top > hi);
+    return top;
+}
+
+// Open dir/name.rep for writing and set the seed of the workload
+static void begin(const char *dir,const char *name,unsigned long long s)
+{
+    char path[512];
+
+    snprintf(path,sizeof(path),"%s/%s.rep",dir,name);
+    if ((out = fopen(path,"w")) == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    fprintf(out,"# %s: synthetic, written by gentrace\n",name);
+    seed = s;
+}
+
+/*
+ * churn - Keep about live blocks of sizes in [lo, hi] allocated, freeing a random one
+ * and allocating a new one ops times, then free them all
+ */
+static void churn(size_t live,size_t ops,size_t lo,size_t hi,int log_sizes)
+{
+    size_t *ids = malloc(live*sizeof(size_t));
+    size_t next_id = 0, i = 0, k = 0;
+
+    for (i = 0; i < live; i++)
+    {
+        ids[i] = next_id++;
+        fprintf(out,"a %zu %zu\n",ids[i],log_sizes ? rand_log(lo,hi) : rand_between(lo,hi));
+    }
+    for (i = 0; i < ops; i++)
+    {
+        k = rand_between(0,live-1);
+        fprintf(out,"f %zu\n",ids[k]);
+        ids[k] = next_id++;
+        fprintf(out,"a %zu %zu\n",ids[k],log_sizes ? rand_log(lo,hi) : rand_between(lo,hi));
+    }
+    for (i = 0; i < live; i++)
+        fprintf(out,"f %zu\n",ids[i]);
+    free(ids);
+}
+
+/*
+ * binary - Allocate n pairs of a small and a big block, free every small one,
+ * then allocate n blocks a little bigger than the small ones, which cannot reuse their holes
+ */
+static void binary(size_t n,size_t small,size_t big)
+{
+    size_t i = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        fprintf(out,"a %zu %zu\n",2*i,small);
+        fprintf(out,"a %zu %zu\n",2*i+1,big);
+    }
+    for (i = 0; i < n; i++)
+        fprintf(out,"f %zu\n",2*i);
+    for (i = 0; i < n; i++)
+        fprintf(out,"a %zu %zu\n",2*n+i,small+big/2);
+    for (i = 0; i < 3*n; i++)
+        if (i >= 2*n || (i&1) == 1)
+            fprintf(out,"f %zu\n",i);
+}
+
+/*
+ * coalescing - Allocate two neighbours, free both and allocate one block as big as both,
+ * which only fits when the two were coalesced
+ */
+static void coalescing(size_t n,size_t size)
+{
+    size_t i = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        fprintf(out,"a %zu %zu\n",3*i,size);
+        fprintf(out,"a %zu %zu\n",3*i+1,size);
+        fprintf(out,"f %zu\n",3*i);
+        fprintf(out,"f %zu\n",3*i+1);
+        fprintf(out,"a %zu %zu\n",3*i+2,2*size);
+        fprintf(out,"f %zu\n",3*i+2);
+    }
+}
+
+/*
+ * grow - Grow n buffers together with realloc, each by a random step, with small blocks
+ * allocated in between so the buffers cannot always grow in place
+ */
+static void grow(size_t n,size_t steps,size_t step)
+{
+    size_t *size = calloc(n,sizeof(size_t));
+    size_t i = 0, k = 0, next_id = n;
+
+    for (k = 0; k < n; k++)
+    {
+        size[k] = rand_between(1,step);
+        fprintf(out,"a %zu %zu\n",k,size[k]);
+    }
+    for (i = 0; i < steps; i++)
+    {
+        k = rand_between(0,n-1);
+        size[k] += rand_between(1,step);
+        fprintf(out,"r %zu %zu\n",k,size[k]);
+        if (i%4 == 0)
+            fprintf(out,"a %zu %zu\n",next_id++,rand_between(16,128));
+    }
+    for (k = 0; k < next_id; k++)
+        fprintf(out,"f %zu\n",k);
+    free(size);
+}
+
+/*
+ * stack - Allocate n blocks, free them in reverse (lifo) or in the same order (fifo), twice
+ */
+static void stack(size_t n,size_t lo,size_t hi,int fifo)
+{
+    size_t i = 0, round = 0;
+
+    for (round = 0; round < 2; round++)
+    {
+        for (i = 0; i < n; i++)
+            fprintf(out,"a %zu %zu\n",round*n+i,rand_log(lo,hi));
+        for (i = 0; i < n; i++)
+            fprintf(out,"f %zu\n",round*n+(fifo ? i : n-1-i));
+    }
+}
+
+int main(int argc,char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr,"usage: %s dir\n",argv[0]);
+        return 2;
+    }
+    begin(argv[1],"small-churn",1);
+    churn(2000,10000,1,512,0);
+    fclose(out);
+    begin(argv[1],"mixed-churn",2);
+    churn(2000,10000,1,16384,1);
+    fclose(out);
+    begin(argv[1],"large-churn",3);
+    churn(64,2000,4096,1<<20,1);
+    fclose(out);
+    begin(argv[1],"binary",4);
+    binary(4000,64,448);
+    fclose(out);
+    begin(argv[1],"coalescing",5);
+    coalescing(4000,4000);
+    fclose(out);
+    begin(argv[1],"realloc-grow",6);
+    grow(32,8000,512);
+    fclose(out);
+    begin(argv[1],"lifo",7);
+    stack(8000,16,4096,0);
+    fclose(out);
+    begin(argv[1],"fifo",8);
+    stack(8000,16,4096,1);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * latbench.c
+ *	Measure the latency of every mm_malloc, mm_free and mm_realloc call, to catch the outliers
+ *	(a long free_tree walk, delete_node looking for a successor, an extend_heap or mmap system call)
+ *	which averages hide. Each call is timed with the cycle counter and counted in an HDR-style
+ *	histogram of its operation and size class: buckets grow with powers of 2 and every power of 2
+ *	is split in SUB linear buckets, so a value is known within 1/SUB of itself at any magnitude.
+ *	The harness prints p50, p99, p99.9 and max in nanoseconds for every operation and size class.
+ *
+ *	The workload is the traces given on the command line (the mdriver format: a id size, f id, r id size),
+ *	replayed ROUNDS times each on a fresh heap, or without any trace a random churn:
+ *	live blocks of log-uniform sizes up to max size, with one free and one malloc
+ *	(or one realloc, for the given percentage) per step.
+ *
+ *	usage: latbench [-n rounds] [trace...]
+ *	       latbench [-l live blocks] [-o steps] [-s max size] [-r realloc percent]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+// lfence keeps the counter from being read before the timed call is done
+#define CYCLES() (_mm_lfence(),__rdtsc())
+#else
+#define CYCLES() now_ns()
+#endif
+
+#define ROUNDS 10
+#define LINE 256
+#define SUB_BITS 5
+#define SUB (1<<SUB_BITS)
+#define BUCKETS (64*SUB)
+
+enum { OP_MALLOC, OP_FREE, OP_REALLOC, OP_KINDS };
+static const char *op_name[OP_KINDS] = { "malloc", "free", "realloc" };
+
+// Size classes: slab sizes, small and big heap blocks, and mapped blocks
+#define CLASSES 5
+static const size_t class_max[CLASSES] = { 64, 512, 4096, 128<<10, (size_t)-1 };
+static const char *class_name[CLASSES] = { "<=64", "<=512", "<=4K", "<=128K", ">128K" };
+
+typedef struct {
+    size_t count[BUCKETS];
+    size_t total;
+    unsigned long long max;
+} hist_t;
+
+typedef struct {
+    int type;
+    size_t id;
+    size_t size;
+} op_t;
+
+static hist_t hist[OP_KINDS][CLASSES];
+static double ns_per_cycle = 1;
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+// Measure how many nanoseconds a cycle of CYCLES takes, over 100ms
+static void calibrate()
+{
+    unsigned long long c0 = CYCLES(), t0 = now_ns(), c1 = 0, t1 = 0;
+
+    do
+    {
+        c1 = CYCLES();
+        t1 = now_ns();
+    } while (t1-t0 < 100000000ULL);
+    ns_per_cycle = (double)(t1-t0)/(c1-c0);
+}
+
+// Bucket of a value: values below SUB have their own bucket, then SUB buckets per power of 2
+static int bucket_of(unsigned long long v)
+{
+    int e = 0;
+
+    if (v < SUB)
+        return (int)v;
+    e = 63-__builtin_clzll(v);
+    return (e-SUB_BITS+1)*SUB+(int)((v>>(e-SUB_BITS))&(SUB-1));
+}
+
+// Highest value counted in bucket b
+static unsigned long long bucket_top(int b)
+{
+    int e = 0;
+
+    if (b < SUB)
+        return (unsigned long long)b;
+    e = b/SUB+SUB_BITS-1;
+    return (((unsigned long long)(SUB+b%SUB)+1)<<(e-SUB_BITS))-1;
+}
+
+static int class_of(size_t size)
+{
+    int c = 0;
+
+    while (size > class_max[c])
+        c++;
+    return c;
+}
+
+static void record(int op,size_t size,unsigned long long cycles)
+{
+    hist_t *h = &hist[op][class_of(size)];
+
+    h->count[bucket_of(cycles)]++;
+    h->total++;
+    if (cycles > h->max)
+        h->max = cycles;
+}
+
+// Value under which a fraction p of the calls counted in h fall, in cycles
+static unsigned long long percentile(const hist_t *h,double p)
+{
+    size_t rank = (size_t)(p*h->total+0.5), seen = 0;
+    int b = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < BUCKETS; b++)
+        if ((seen += h->count[b]) >= rank)
+            return (bucket_top(b) < h->max) ? bucket_top(b) : h->max;
+    return h->max;
+}
+
+static void *timed_malloc(size_t size)
+{
+    unsigned long long start = CYCLES();
+    void *p = mm_malloc(size);
+
+    record(OP_MALLOC,size,CYCLES()-start);
+    if (p == NULL && size != 0)
+    {
+        fprintf(stderr,"latbench: mm_malloc(%zu) failed\n",size);
+        exit(1);
+    }
+    return p;
+}
+
+static void timed_free(void *p,size_t size)
+{
+    unsigned long long start = CYCLES();
+
+    mm_free(p);
+    record(OP_FREE,size,CYCLES()-start);
+}
+
+static void *timed_realloc(void *p,size_t size)
+{
+    unsigned long long start = CYCLES();
+
+    p = mm_realloc(p,size);
+    record(OP_REALLOC,size,CYCLES()-start);
+    if (p == NULL && size != 0)
+    {
+        fprintf(stderr,"latbench: mm_realloc(%zu) failed\n",size);
+        exit(1);
+    }
+    return p;
+}
+
+static void fresh_heap()
+{
+    mem_reset_brk();
+    if (mm_init() < 0)
+    {
+        fprintf(stderr,"latbench: mm_init failed\n");
+        exit(1);
+    }
+}
+
+// Read the requests of a trace into *ops, return their number and the number of ids in *nids
+static size_t read_trace(const char *path,op_t **ops,size_t *nids)
+{
+    FILE *fp = fopen(path,"r");
+    char line[LINE];
+    size_t n = 0, cap = 0;
+    op_t op;
+    char c = 0;
+
+    *ops = NULL;
+    *nids = 0;
+    if (fp == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line,sizeof(line),fp) != NULL)
+    {
+        op.size = 0;
+        if (sscanf(line," %c %zu %zu",&c,&op.id,&op.size) < 2)
+            continue;
+        if (c == 'a')
+            op.type = OP_MALLOC;
+        else if (c == 'f')
+            op.type = OP_FREE;
+        else if (c == 'r')
+            op.type = OP_REALLOC;
+        else
+            continue;
+        if (n == cap)
+        {
+            cap = cap ? cap*2 : 4096;
+            if ((*ops = realloc(*ops,cap*sizeof(op_t))) == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        (*ops)[n++] = op;
+        if (op.id >= *nids)
+            *nids = op.id+1;
+    }
+    fclose(fp);
+    return n;
+}
+
+static void replay(const char *path,int rounds)
+{
+    op_t *ops = NULL;
+    size_t n = 0, nids = 0, i = 0;
+    void **blocks = NULL;
+    size_t *sizes = NULL;
+    int r = 0;
+
+    n = read_trace(path,&ops,&nids);
+    blocks = calloc(nids+1,sizeof(void *));
+    sizes = calloc(nids+1,sizeof(size_t));
+    for (r = 0; r < rounds; r++)
+    {
+        fresh_heap();
+        for (i = 0; i < n; i++)
+        {
+            if (ops[i].type == OP_MALLOC)
+            {
+                blocks[ops[i].id] = timed_malloc(ops[i].size);
+                sizes[ops[i].id] = ops[i].size;
+            }
+            else if (ops[i].type == OP_FREE)
+            {
+                timed_free(blocks[ops[i].id],sizes[ops[i].id]);
+                blocks[ops[i].id] = NULL;
+            }
+            else
+            {
+                blocks[ops[i].id] = timed_realloc(blocks[ops[i].id],ops[i].size);
+                sizes[ops[i].id] = ops[i].size;
+            }
+        }
+        // blocks a recorded trace left allocated
+        for (i = 0; i < nids; i++)
+        {
+            mm_free(blocks[i]);
+            blocks[i] = NULL;
+        }
+    }
+    free(ops);
+    free(blocks);
+    free(sizes);
+}
+
+// xorshift64*
+static unsigned long long next_rand(unsigned long long *seed)
+{
+    *seed ^= *seed>>12;
+    *seed ^= *seed<<25;
+    *seed ^= *seed>>27;
+    return *seed*2685821657736338717ULL;
+}
+
+// A log-uniform size in [1, max]
+static size_t rand_size(unsigned long long *seed,size_t max)
+{
+    size_t top = 0, size = 0;
+
+    do
+    {
+        top = (size_t)1<<(next_rand(seed)%64);
+        size = top+next_rand(seed)%top;
+    } while (size == 0 || size > max);
+    return size;
+}
+
+static void churn(size_t live,size_t steps,size_t max,int realloc_pct)
+{
+    void **blocks = malloc(live*sizeof(void *));
+    size_t *sizes = malloc(live*sizeof(size_t));
+    unsigned long long seed = 88172645463325252ULL;
+    size_t i = 0, k = 0;
+
+    fresh_heap();
+    for (k = 0; k < live; k++)
+    {
+        sizes[k] = rand_size(&seed,max);
+        blocks[k] = timed_malloc(sizes[k]);
+    }
+    for (i = 0; i < steps; i++)
+    {
+        k = next_rand(&seed)%live;
+        if ((int)(next_rand(&seed)%100) < realloc_pct)
+        {
+            sizes[k] = rand_size(&seed,max);
+            blocks[k] = timed_realloc(blocks[k],sizes[k]);
+        }
+        else
+        {
+            timed_free(blocks[k],sizes[k]);
+            sizes[k] = rand_size(&seed,max);
+            blocks[k] = timed_malloc(sizes[k]);
+        }
+    }
+    for (k = 0; k < live; k++)
+        timed_free(blocks[k],sizes[k]);
+    free(blocks);
+    free(sizes);
+}
+
+int main(int argc,char **argv)
+{
+    int rounds = ROUNDS, opt = 0, op = 0, c = 0, realloc_pct = 10;
+    size_t live = 10000, steps = 1000000, max = 64<<10;
+    const hist_t *h = NULL;
+
+    while ((opt = getopt(argc,argv,"n:l:o:s:r:")) != -1)
+    {
+        if (opt == 'n')
+            rounds = atoi(optarg);
+        else if (opt == 'l')
+            live = (size_t)atol(optarg);
+        else if (opt == 'o')
+            steps = (size_t)atol(optarg);
+        else if (opt == 's')
+            max = (size_t)atol(optarg);
+        else if (opt == 'r')
+            realloc_pct = atoi(optarg);
+        else
+        {
+            fprintf(stderr,"usage: %s [-n rounds] [trace...]\n"
+                    "       %s [-l live blocks] [-o steps] [-s max size] [-r realloc percent]\n",argv[0],argv[0]);
+            return 2;
+        }
+    }
+    if (live == 0 || max == 0)
+    {
+        fprintf(stderr,"latbench: live blocks and max size must be positive\n");
+        return 2;
+    }
+
+    calibrate();
+    mem_init();
+    if (optind < argc)
+        for ( ; optind < argc; optind++)
+            replay(argv[optind],rounds);
+    else
+        churn(live,steps,max,realloc_pct);
+
+    printf("%-8s %-7s %10s %10s %10s %10s %12s\n","op","size","calls","p50(ns)","p99(ns)","p99.9(ns)","max(ns)");
+    for (op = 0; op < OP_KINDS; op++)
+        for (c = 0; c < CLASSES; c++)
+        {
+            h = &hist[op][c];
+            if (h->total == 0)
+                continue;
+            printf("%-8s %-7s %10zu %10.0f %10.0f %10.0f %12.0f\n",op_name[op],class_name[c],h->total,
+                   percentile(h,0.5)*ns_per_cycle,percentile(h,0.99)*ns_per_cycle,
+                   percentile(h,0.999)*ns_per_cycle,h->max*ns_per_cycle);
+        }
+    return 0;
+}
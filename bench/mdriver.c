@@ -0,0 +1,285 @@
+/*
+ * mdriver.c
+ *	Replay malloc-lab style traces against mm_malloc/mm_free/mm_realloc and measure them the same way every time.
+ *	A trace is a text file with one request per line:
+ *		a id size	allocate size bytes as block id
+ *		f id		free block id
+ *		r id size	reallocate block id to size bytes
+ *	Any other line (the numeric header of the CMU traces, # comments) is skipped.
+ *	The trace is read once, then replayed ROUNDS times, each time on a fresh heap (mem_reset_brk, mm_init).
+ *
+ *	For every trace the driver prints the requests of each kind, the operations per second of the replay,
+ *	and the peak utilization: the most payload bytes live at once over the memory the allocator took
+ *	for them (heap, slabs and mapped blocks, from mm_stats). A separate untimed replay measures it,
+ *	so mm_stats costs nothing in the ops/sec column. The last line sums the counts, the time of all traces
+ *	and averages the utilization.
+ *
+ *	usage: mdriver [-c] [-n rounds] trace...
+ *		-c	fill every payload, check it is intact on free and realloc, and run mm_checkheap after each replay
+ *		-n	replays timed for each trace (default 10)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define ROUNDS 10
+#define LINE 256
+
+enum { OP_ALLOC, OP_FREE, OP_REALLOC, OP_KINDS };
+
+typedef struct {
+    int type;
+    size_t id;
+    size_t size;
+} op_t;
+
+typedef struct {
+    op_t *ops;
+    size_t nops;
+    size_t nids;              // ids go from 0 to nids-1
+    size_t count[OP_KINDS];   // requests of each kind
+} trace_t;
+
+static int check = 0;
+
+static double now_sec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+// Read the requests of a trace, return 0 or -1 when the file cannot be read
+static int read_trace(const char *path,trace_t *tr)
+{
+    FILE *fp = fopen(path,"r");
+    char line[LINE];
+    size_t cap = 0;
+    op_t op;
+    char c = 0;
+
+    memset(tr,0,sizeof(*tr));
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line,sizeof(line),fp) != NULL)
+    {
+        op.size = 0;
+        if (sscanf(line," %c %zu %zu",&c,&op.id,&op.size) < 2)
+            continue;
+        if (c == 'a')
+            op.type = OP_ALLOC;
+        else if (c == 'f')
+            op.type = OP_FREE;
+        else if (c == 'r')
+            op.type = OP_REALLOC;
+        else
+            continue;
+
+        if (tr->nops == cap)
+        {
+            cap = cap ? cap*2 : 4096;
+            if ((tr->ops = realloc(tr->ops,cap*sizeof(op_t))) == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        tr->ops[tr->nops++] = op;
+        tr->count[op.type]++;
+        if (op.id >= tr->nids)
+            tr->nids = op.id+1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// The byte a payload of block id is filled with
+static unsigned char fill_byte(size_t id)
+{
+    return (unsigned char)(id*131+7);
+}
+
+// Check that the first size bytes of block id still hold its fill byte
+static int check_fill(const char *name,size_t id,const unsigned char *p,size_t size)
+{
+    size_t i = 0;
+
+    for (i = 0; i < size; i++)
+        if (p[i] != fill_byte(id))
+        {
+            fprintf(stderr,"%s: payload of block %zu changed at byte %zu\n",name,id,i);
+            return -1;
+        }
+    return 0;
+}
+
+/*
+ * replay - Run the trace once on a fresh heap. When peak is not NULL, measure the peak utilization
+ * into it; when check is set, fill and check the payloads
+ * return 0 or -1 when an allocation fails or a payload was damaged
+ */
+static int replay(const char *name,const trace_t *tr,void **blocks,size_t *sizes,double *peak)
+{
+    size_t i = 0, live = 0, max_live = 0, footprint = 0;
+    const op_t *op = NULL;
+    void *p = NULL;
+    mm_stats_t st;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+    {
+        fprintf(stderr,"%s: mm_init failed\n",name);
+        return -1;
+    }
+    memset(blocks,0,tr->nids*sizeof(void *));
+    memset(sizes,0,tr->nids*sizeof(size_t));
+
+    for (i = 0; i < tr->nops; i++)
+    {
+        op = &tr->ops[i];
+        switch (op->type)
+        {
+            case OP_ALLOC:
+                if ((p = mm_malloc(op->size)) == NULL && op->size != 0)
+                {
+                    fprintf(stderr,"%s: mm_malloc(%zu) failed at request %zu\n",name,op->size,i);
+                    return -1;
+                }
+                if (check && p != NULL)
+                    memset(p,fill_byte(op->id),op->size);
+                blocks[op->id] = p;
+                live += op->size;
+                sizes[op->id] = op->size;
+                break;
+            case OP_FREE:
+                if (check && check_fill(name,op->id,blocks[op->id],sizes[op->id]) < 0)
+                    return -1;
+                mm_free(blocks[op->id]);
+                blocks[op->id] = NULL;
+                live -= sizes[op->id];
+                sizes[op->id] = 0;
+                break;
+            case OP_REALLOC:
+                if (check && check_fill(name,op->id,blocks[op->id],sizes[op->id]) < 0)
+                    return -1;
+                if ((p = mm_realloc(blocks[op->id],op->size)) == NULL && op->size != 0)
+                {
+                    fprintf(stderr,"%s: mm_realloc(%zu) failed at request %zu\n",name,op->size,i);
+                    return -1;
+                }
+                if (check && p != NULL)
+                {
+                    if (check_fill(name,op->id,p,(sizes[op->id] < op->size) ? sizes[op->id] : op->size) < 0)
+                        return -1;
+                    memset(p,fill_byte(op->id),op->size);
+                }
+                blocks[op->id] = p;
+                live += op->size-sizes[op->id];
+                sizes[op->id] = op->size;
+                break;
+        }
+        // the heap and the slabs never shrink, so the footprint is largest at the end
+        // or, for the mapped blocks, when the most bytes are live
+        if (peak != NULL && live > max_live)
+        {
+            max_live = live;
+            mm_stats(&st);
+            if (st.mmap_size > footprint)
+                footprint = st.mmap_size;
+        }
+    }
+    if (check && mm_checkheap() != 0)
+    {
+        fprintf(stderr,"%s: mm_checkheap failed\n",name);
+        return -1;
+    }
+    if (peak != NULL)
+    {
+        mm_stats(&st);
+        footprint += st.heap_size+st.slab_size;
+        *peak = footprint ? (double)max_live/footprint : 0;
+    }
+    // a recorded trace may end with blocks still allocated, their mappings must not outlive the heap
+    for (i = 0; i < tr->nids; i++)
+        mm_free(blocks[i]);
+    return 0;
+}
+
+int main(int argc,char **argv)
+{
+    int rounds = ROUNDS, opt = 0, r = 0, ntraces = 0;
+    trace_t tr;
+    void **blocks = NULL;
+    size_t *sizes = NULL;
+    size_t total[OP_KINDS] = {0}, nops = 0;
+    double start = 0, secs = 0, total_secs = 0, util = 0, total_util = 0;
+
+    while ((opt = getopt(argc,argv,"cn:")) != -1)
+    {
+        if (opt == 'c')
+            check = 1;
+        else if (opt == 'n' && (rounds = atoi(optarg)) > 0)
+            continue;
+        else
+        {
+            fprintf(stderr,"usage: %s [-c] [-n rounds] trace...\n",argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc)
+    {
+        fprintf(stderr,"usage: %s [-c] [-n rounds] trace...\n",argv[0]);
+        return 2;
+    }
+
+    mem_init();
+    printf("%-24s %9s %9s %9s %9s %12s %7s\n","trace","ops","alloc","free","realloc","ops/sec","util");
+    for ( ; optind < argc; optind++)
+    {
+        const char *name = argv[optind];
+
+        if (read_trace(name,&tr) < 0)
+            return 1;
+        blocks = malloc(tr.nids*sizeof(void *)+1);
+        sizes = malloc(tr.nids*sizeof(size_t)+1);
+        if (blocks == NULL || sizes == NULL)
+        {
+            perror("malloc");
+            return 1;
+        }
+        if (replay(name,&tr,blocks,sizes,&util) < 0)
+            return 1;
+
+        start = now_sec();
+        for (r = 0; r < rounds; r++)
+            if (replay(name,&tr,blocks,sizes,NULL) < 0)
+                return 1;
+        secs = (now_sec()-start)/rounds;
+
+        printf("%-24s %9zu %9zu %9zu %9zu %12.0f %6.1f%%\n",(strrchr(name,'/') ? strrchr(name,'/')+1 : name),
+               tr.nops,tr.count[OP_ALLOC],tr.count[OP_FREE],tr.count[OP_REALLOC],
+               secs > 0 ? tr.nops/secs : 0,util*100);
+        nops += tr.nops;
+        for (r = 0; r < OP_KINDS; r++)
+            total[r] += tr.count[r];
+        total_secs += secs;
+        total_util += util;
+        ntraces++;
+        free(tr.ops);
+        free(blocks);
+        free(sizes);
+    }
+    printf("%-24s %9zu %9zu %9zu %9zu %12.0f %6.1f%%\n","total",nops,total[OP_ALLOC],total[OP_FREE],total[OP_REALLOC],
+           total_secs > 0 ? nops/total_secs : 0,total_util*100/ntraces);
+    mem_deinit();
+    return 0;
+}
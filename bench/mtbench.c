@@ -0,0 +1,383 @@
+/*
+ * mtbench.c
+ *	Measure how the allocator scales with threads. Each workload runs with 1, 2, 4, ... up to the
+ *	number of threads asked for, and prints the operations (malloc, free and realloc calls) per second
+ *	of all threads together, the RSS once the work is done and the live blocks are still held,
+ *	and the arena and slab lock acquisitions which had to wait (mm_stats lock_contended).
+ *
+ *	larson		every thread replaces random blocks of an array of slots; after each epoch the arrays
+ *			move to the next thread, so blocks are freed by other threads than the ones that allocated them
+ *	prodcons	producer threads allocate blocks and pass them through a ring to a consumer thread which frees them
+ *	pingpong	every thread allocates a batch of blocks and frees it again, nothing is shared
+ *	shared		all threads swap new blocks into random slots of one shared array and free what they took out,
+ *			some slots are grown or shrunk with realloc
+ *
+ *	Built with -DSYSTEM_MALLOC (bench/mtbench-libc) the same workloads run on the malloc of the C library,
+ *	for comparison; there is no contention count then, and the heap is not reset between runs.
+ *
+ *	usage: mtbench [-t max threads] [-n ops per thread] [-w workload]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef SYSTEM_MALLOC
+#define MALLOC(size) malloc(size)
+#define FREE(p) free(p)
+#define REALLOC(p,size) realloc(p,size)
+#else
+#include "mm.h"
+#include "memlib.h"
+#define MALLOC(size) mm_malloc(size)
+#define FREE(p) mm_free(p)
+#define REALLOC(p,size) mm_realloc(p,size)
+#endif
+
+#define MAX_THREADS 256
+#define SLOTS 1000           // blocks each larson thread keeps
+#define EPOCHS 8             // larson arrays move to the next thread this many times
+#define RING 1024            // blocks a prodcons ring holds
+#define BATCH 64             // blocks a pingpong thread allocates before freeing them
+#define SHARED_SLOTS 4096    // slots of the shared array
+
+typedef struct {
+    int id;
+    int nthreads;
+    size_t ops;              // operations to run
+    unsigned long long seed;
+    size_t done;             // operations run
+} worker_t;
+
+static size_t nops = 1000000;
+static pthread_barrier_t barrier;
+
+// larson: slot arrays, one per thread
+static void **larson_slots[MAX_THREADS];
+
+// prodcons: one single producer, single consumer ring per pair of threads
+typedef struct {
+    void *slot[RING];
+    size_t head;             // next slot the consumer reads, written with __atomic
+    size_t tail;             // next slot the producer writes, written with __atomic
+} ring_t;
+
+static ring_t rings[MAX_THREADS/2];
+
+// shared: slots every thread swaps blocks into with __atomic_exchange_n
+static void *shared_slots[SHARED_SLOTS];
+
+// xorshift64*
+static unsigned long long next_rand(unsigned long long *seed)
+{
+    *seed ^= *seed>>12;
+    *seed ^= *seed<<25;
+    *seed ^= *seed>>27;
+    return *seed*2685821657736338717ULL;
+}
+
+// Mostly small sizes, like the requests of a server: 8 to 512 bytes, and one in 16 up to 8KB
+static size_t rand_size(unsigned long long *seed)
+{
+    unsigned long long r = next_rand(seed);
+
+    if ((r&15) == 0)
+        return 512+(r>>8)%(8192-512);
+    return 8+(r>>8)%505;
+}
+
+// Allocate size bytes and touch the first one, exit when the allocator fails
+static void *alloc_touch(size_t size)
+{
+    char *p = MALLOC(size);
+
+    if (p == NULL)
+    {
+        fprintf(stderr,"mtbench: allocation of %zu bytes failed\n",size);
+        exit(1);
+    }
+    p[0] = 1;
+    return p;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+// Resident set size of the process in KB, from /proc/self/statm
+static size_t rss_kb()
+{
+    FILE *fp = fopen("/proc/self/statm","r");
+    size_t pages = 0, resident = 0;
+
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp,"%zu %zu",&pages,&resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident*(size_t)(sysconf(_SC_PAGESIZE)/1024);
+}
+
+static void *larson(void *arg)
+{
+    worker_t *w = arg;
+    void **slots = NULL;
+    size_t i = 0, k = 0, e = 0;
+
+    larson_slots[w->id] = malloc(SLOTS*sizeof(void *));
+    for (i = 0; i < SLOTS; i++)
+        larson_slots[w->id][i] = alloc_touch(rand_size(&w->seed));
+    w->done += SLOTS;
+    pthread_barrier_wait(&barrier);
+
+    for (e = 0; e < EPOCHS; e++)
+    {
+        slots = larson_slots[(w->id+e)%w->nthreads];
+        for (i = 0; i < w->ops/2/EPOCHS; i++)
+        {
+            k = next_rand(&w->seed)%SLOTS;
+            FREE(slots[k]);
+            slots[k] = alloc_touch(rand_size(&w->seed));
+        }
+        w->done += 2*i;
+        pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+static void larson_cleanup(int nthreads)
+{
+    int t = 0;
+    size_t i = 0;
+
+    for (t = 0; t < nthreads; t++)
+    {
+        for (i = 0; i < SLOTS; i++)
+            FREE(larson_slots[t][i]);
+        free(larson_slots[t]);
+    }
+}
+
+// The even thread of a pair produces, the odd one consumes; a lone last thread does both
+static void *prodcons(void *arg)
+{
+    worker_t *w = arg;
+    ring_t *ring = &rings[w->id/2];
+    size_t i = 0, n = w->ops/2, pos = 0;
+    void *p = NULL;
+
+    if (w->id%2 == 0 && w->id+1 == w->nthreads)
+    {
+        for (i = 0; i < n; i += BATCH)
+        {
+            for (pos = 0; pos < BATCH; pos++)
+                ring->slot[pos] = alloc_touch(rand_size(&w->seed));
+            for (pos = 0; pos < BATCH; pos++)
+                FREE(ring->slot[pos]);
+        }
+        w->done = 2*i;
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (w->id%2 == 0)
+        {
+            p = alloc_touch(rand_size(&w->seed));
+            while (i-__atomic_load_n(&ring->head,__ATOMIC_ACQUIRE) >= RING)
+                sched_yield();
+            ring->slot[i%RING] = p;
+            __atomic_store_n(&ring->tail,i+1,__ATOMIC_RELEASE);
+        }
+        else
+        {
+            while (__atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE) == i)
+                sched_yield();
+            FREE(ring->slot[i%RING]);
+            __atomic_store_n(&ring->head,i+1,__ATOMIC_RELEASE);
+        }
+    }
+    w->done = n;
+    return NULL;
+}
+
+static void *pingpong(void *arg)
+{
+    worker_t *w = arg;
+    void *batch[BATCH];
+    size_t i = 0, k = 0;
+
+    for (i = 0; i < w->ops/2; i += BATCH)
+    {
+        for (k = 0; k < BATCH; k++)
+            batch[k] = alloc_touch(rand_size(&w->seed));
+        // free in the reverse order every other batch
+        for (k = 0; k < BATCH; k++)
+            FREE(batch[(i/BATCH)%2 ? BATCH-1-k : k]);
+    }
+    w->done = 2*i;
+    return NULL;
+}
+
+static void *shared(void *arg)
+{
+    worker_t *w = arg;
+    size_t i = 0, k = 0, size = 0;
+    unsigned long long r = 0;
+    char *p = NULL;
+
+    for (i = 0; i < w->ops/2; i++)
+    {
+        r = next_rand(&w->seed);
+        k = r%SHARED_SLOTS;
+        size = rand_size(&w->seed);
+        if ((r>>32)%8 == 0)
+        {
+            // take the block out, resize it and put it back
+            if ((p = __atomic_exchange_n(&shared_slots[k],NULL,__ATOMIC_ACQ_REL)) == NULL)
+                p = alloc_touch(size);
+            else if ((p = REALLOC(p,size)) == NULL)
+            {
+                fprintf(stderr,"mtbench: realloc to %zu bytes failed\n",size);
+                exit(1);
+            }
+        }
+        else
+            p = alloc_touch(size);
+        p[size-1] = 2;
+        FREE(__atomic_exchange_n(&shared_slots[k],p,__ATOMIC_ACQ_REL));
+    }
+    w->done = 2*i;
+    return NULL;
+}
+
+static void shared_cleanup(int nthreads)
+{
+    size_t i = 0;
+
+    (void)nthreads;
+    for (i = 0; i < SHARED_SLOTS; i++)
+    {
+        FREE(shared_slots[i]);
+        shared_slots[i] = NULL;
+    }
+}
+
+static const struct {
+    const char *name;
+    void *(*run)(void *);
+    void (*cleanup)(int nthreads);
+    int barrier;// the workload waits on the barrier EPOCHS+1 times
+} workloads[] = {
+    { "larson", larson, larson_cleanup, 1 },
+    { "prodcons", prodcons, NULL, 0 },
+    { "pingpong", pingpong, NULL, 0 },
+    { "shared", shared, shared_cleanup, 0 },
+};
+
+#define NWORKLOADS (int)(sizeof(workloads)/sizeof(workloads[0]))
+
+// Run workload wl with nthreads threads and print its line
+static void run(int wl,int nthreads)
+{
+    pthread_t tid[MAX_THREADS];
+    worker_t w[MAX_THREADS];
+    size_t ops = 0;
+    double start = 0, secs = 0;
+    int t = 0;
+#ifndef SYSTEM_MALLOC
+    mm_stats_t st;
+    size_t contended = 0;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+    {
+        fprintf(stderr,"mtbench: mm_init failed\n");
+        exit(1);
+    }
+    mm_stats(&st);
+    contended = st.lock_contended;
+#endif
+    memset(rings,0,sizeof(rings));
+    if (workloads[wl].barrier)
+        pthread_barrier_init(&barrier,NULL,nthreads);
+
+    start = now_sec();
+    for (t = 0; t < nthreads; t++)
+    {
+        w[t].id = t;
+        w[t].nthreads = nthreads;
+        w[t].ops = nops;
+        w[t].seed = 0x9e3779b97f4a7c15ULL*(t+1);
+        w[t].done = 0;
+        if (pthread_create(&tid[t],NULL,workloads[wl].run,&w[t]) != 0)
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (t = 0; t < nthreads; t++)
+    {
+        pthread_join(tid[t],NULL);
+        ops += w[t].done;
+    }
+    secs = now_sec()-start;
+
+    printf("%-10s %8d %14.0f %10zu",workloads[wl].name,nthreads,secs > 0 ? ops/secs : 0,rss_kb());
+#ifndef SYSTEM_MALLOC
+    mm_stats(&st);
+    printf(" %12zu\n",st.lock_contended-contended);
+#else
+    printf(" %12s\n","-");
+#endif
+    if (workloads[wl].cleanup != NULL)
+        workloads[wl].cleanup(nthreads);
+    if (workloads[wl].barrier)
+        pthread_barrier_destroy(&barrier);
+}
+
+int main(int argc,char **argv)
+{
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *only = NULL;
+    int opt = 0, wl = 0, n = 0;
+
+    while ((opt = getopt(argc,argv,"t:n:w:")) != -1)
+    {
+        if (opt == 't')
+            max_threads = atoi(optarg);
+        else if (opt == 'n')
+            nops = (size_t)atol(optarg);
+        else if (opt == 'w')
+            only = optarg;
+        else
+        {
+            fprintf(stderr,"usage: %s [-t max threads] [-n ops per thread] [-w workload]\n",argv[0]);
+            return 2;
+        }
+    }
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+#ifndef SYSTEM_MALLOC
+    mem_init();
+#endif
+    printf("%-10s %8s %14s %10s %12s\n","workload","threads","ops/sec","rss(KB)","contended");
+    for (wl = 0; wl < NWORKLOADS; wl++)
+    {
+        if (only != NULL && strcmp(only,workloads[wl].name) != 0)
+            continue;
+        for (n = 1; n < max_threads; n *= 2)
+            run(wl,n);
+        run(wl,max_threads);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * realloc_bench.c
+ *	Measure how the cost of growing a buffer with mm_realloc depends on the size of the buffer.
+ *	For every size, a buffer of that size is grown STEPS times by one page, and the new page is written.
+ *	The same growth is also done the way mm_realloc did it before blocks could be remapped:
+ *	mm_malloc, memcpy of the whole payload and mm_free.
+ *	Both are printed in microseconds per grow, so the copy column grows with the size
+ *	while the realloc column should stay flat for mapped blocks.
+ *
+ *	usage: realloc_bench [max size in MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define STEPS 16
+#define GROW 4096
+
+static double now_us()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+// Grow a buffer of size bytes STEPS times with mm_realloc, return the time per grow
+static double grow_realloc(size_t size)
+{
+    char *buf = mm_malloc(size);
+    double start = 0;
+    int i = 0;
+    
+    if (buf == NULL)
+        return -1;
+    memset(buf,1,size);
+    
+    start = now_us();
+    for (i = 0; i < STEPS; i++)
+    {
+        if ((buf = mm_realloc(buf,size+GROW)) == NULL)
+            return -1;
+        memset(buf+size,1,GROW);
+        size += GROW;
+    }
+    start = (now_us()-start)/STEPS;
+    mm_free(buf);
+    return start;
+}
+
+// Same growth with malloc, copy and free
+static double grow_copy(size_t size)
+{
+    char *buf = mm_malloc(size);
+    char *newbuf = NULL;
+    double start = 0;
+    int i = 0;
+    
+    if (buf == NULL)
+        return -1;
+    memset(buf,1,size);
+    
+    start = now_us();
+    for (i = 0; i < STEPS; i++)
+    {
+        if ((newbuf = mm_malloc(size+GROW)) == NULL)
+            return -1;
+        memcpy(newbuf,buf,size);
+        mm_free(buf);
+        buf = newbuf;
+        memset(buf+size,1,GROW);
+        size += GROW;
+    }
+    start = (now_us()-start)/STEPS;
+    mm_free(buf);
+    return start;
+}
+
+int main(int argc,char **argv)
+{
+    size_t max_mb = (argc > 1) ? (size_t)atol(argv[1]) : 256;
+    size_t size = 0;
+    double t_realloc = 0, t_copy = 0;
+    
+    mem_init();
+    printf("%12s %16s %16s\n","size","realloc(us)","copy(us)");
+    for (size = (size_t)256<<10; size <= (max_mb<<20); size <<= 1)
+    {
+        // start from a fresh heap, so the threshold freed blocks raise does not carry over
+        mem_reset_brk();
+        if (mm_init() < 0)
+            return 1;
+        t_realloc = grow_realloc(size);
+        
+        mem_reset_brk();
+        if (mm_init() < 0)
+            return 1;
+        t_copy = grow_copy(size);
+        
+        printf("%12zu %16.2f %16.2f\n",size,t_realloc,t_copy);
+    }
+    return 0;
+}
@@ -11,16 +11,136 @@
  *	and use brother to save the address of next free block in this list,
  *	also assign the right-child to -1 which differ from the tree node which do not have a right-child(on this case, assign it to 0).
  *
- *	Besides, it is wrapped by a 4 bytes header and a 4 bytes footer, which are used for coalescing
+ *	Besides, it is wrapped by a 4 bytes header and a 4 bytes footer, which are used for coalescing.
+ *	An allocated block has no footer: bit 1 of every header (PREV_ALLOC) tells whether the previous
+ *	block is allocated, and coalesce only reads the footer of the previous block when that bit is 0.
+ *
+ *	Every word in a block is 4 bytes, also on 64-bit machines. The links (LEFT, RIGHT, PART, BROS)
+ *	are not pointers but signed offsets from the block holding them, in units of 8 bytes, so a free block
+ *	stays 24 bytes, a heap can be up to 16GB, and a link means the same in the heap of any arena. A null link is 0, and the right-child mark of a list node is LIST_MARK.
  *	
  *	The minimum size of a free block is 24 bytes.  
- *	When the size we need to allocate is no bigger than 512, we allocate a space with size of upper bond in (2^n)+4+4. 
- *	For example, when we need 10 bytes space, the upper bound in (2^n)+4+4 is (2^4)+4+4=24. 
- *	When the size we need is bigger than 512, we allocate a space with the size we need and other 8 bytes for pointers.
+ *	When the size we need to allocate is no bigger than 512 (SLAB_MAX), the block does not come from free_tree
+ *	but from a slab: a 4KB page of objects of the same class with no header at all.
+ *	The classes go by 16 bytes up to 128, then 4 classes per power of 2 (160, 192, 224, 256, 320, ... 512),
+ *	so a 33 bytes request takes 48 bytes and a 257 bytes one takes 320.
+ *	A slab starts with a slab_t header holding the free list of its objects. The slabs live in their own
+ *	mapping, so mm_free knows a slab object by its address and finds its slab by rounding it down to 4KB.
+ *	When the size we need is bigger than 512, we allocate a space with the size we need and other 4 bytes for the header.
+ *	Heap blocks are multiples of BLOCK_ALIGN: 8 bytes, or 16 in libmm.so (MM_PRELOAD), where every heap starts
+ *	16 bytes aligned so each heap block is 16 bytes aligned as glibc's blocks are.
+ *
+ *	Coalescing is deferred for heap blocks of up to QUICK_MAX (1KB) bytes: mm_free pushes such a block on
+ *	the LIFO quick list of its exact size, still marked allocated so its neighbours do not merge with it,
+ *	and the next allocation of that size pops it without find_fit or place. When find_fit misses, a list
+ *	grows past QUICK_DEPTH blocks or the lists hold more than QUICK_BUDGET bytes, all the lists are freed
+ *	through free_block, coalesced and added to free_tree.
+ *
+ *	A request of at least mmap_threshold bytes (128KB at first) gets an anonymous mapping of its own:
+ *	the mapping length is kept in its first 8 bytes and the header before bp has the MMAPPED bit,
+ *	so mm_free unmaps it right away instead of leaving the space in the heap.
+ *	As in glibc, freeing a mapped block bigger than the threshold raises the threshold to its size
+ *	(up to MMAP_THRESHOLD_MAX), unless mm_set_mmap_threshold fixed it.
+ *	mm_realloc grows or shrinks a mapped block with mremap, which moves pages instead of copying bytes.
+ *
+ *	A block often holds more than was asked: the rest of a slab object, a page rounded mapping, or the tail
+ *	place did not split off because it was smaller than MINSIZE. mm_usable_size tells how much,
+ *	and mm_malloc_at_least returns it with the block, so a growing buffer can use all of it.
+ *	mm_realloc returns the block at once, without locking, when the new size fits in it and leaves
+ *	no tail to split off.
+ *
+ *	A free block of at least 2 pages keeps in the word after BROS the time (ms since mm_init) it became free.
+ *	Every PURGE_TICKS frees and on every extend_heap, if a quarter of purge_decay passed since the last pass,
+ *	the free blocks which stayed free longer than purge_decay get the whole pages between that stamp
+ *	and their footer given back with madvise(MADV_DONTNEED); the stamp then becomes PURGED.
+ *	The header, the links and the footer stay, so the block is still in free_tree.
+ *
+ *	The heap grows geometrically: each extend_heap takes at least the arena's grow step, which starts at
+ *	CHUNKSIZE and doubles up to GROW_MAX, so a warming up heap makes a few dozen growth calls instead of
+ *	one per KB. A purge pass which gives pages back halves the step again. The address space is reserved
+ *	up front with PROT_NONE mappings (the memlib region, the ARENA_REGION of an arena) and arena_sbrk or
+ *	mem_sbrk commits the pages with mprotect as the break reaches them; mm_init decommits them again.
+ *
+ *	Building with -DMM_THP backs the heaps with 2MB transparent huge pages, so walking free_tree through
+ *	a big heap takes fewer TLB misses: mem_reserve aligns every reservation to 2MB and advises it
+ *	MADV_HUGEPAGE, the pages are committed by whole huge pages (commit_size), and a free block is only
+ *	purged once it spans two of them, by the huge pages it holds whole, so a purge never splits one.
+ *	With -DMM_HUGETLB too, a kernel which refuses MADV_HUGEPAGE gets the regions mapped with MAP_HUGETLB
+ *	from the hugetlb pool instead, which has to be configured (vm.nr_hugepages) big enough for the heap.
+ *
+ *	Every thread keeps a small cache of free objects for each slab class. A malloc/free pair of a small size
+ *	only pushes and pops the thread's own list, so it never touches the slabs or any lock.
+ *	An empty list is refilled with TC_BATCH objects under the lock; a list holds at most
+ *	TC_DEPTH objects, and when it is full TC_BATCH objects are given back to their slabs.
+ *	When a thread exits, its cache is flushed back to the slabs.
+ *	mm_free_sized (C++ sized delete, see malloc_new.cc) takes the class from the size the caller gives,
+ *	so a small free does not even read the slab header.
+ *
+ *	The heap is split into arenas, one per CPU up to MAX_ARENAS (or mm_set_arenas), each with its own
+ *	free_tree, partial slabs and lock. A thread takes the next arena round-robin on its first allocation
+ *	and allocates from it from then on. main_arena is the mem_sbrk heap; every other arena is a 1GB
+ *	(ARENA_REGION) reserved mapping aligned to its size, with its arena_t at the start, so mm_free finds
+ *	the arena of a block from its address alone and frees it there, whichever thread calls it.
+ *	A slab keeps a pointer to the arena which took it; the pool of empty slabs is shared under slab_lock.
+ *	A thread freeing a block of another arena does not wait for that lock: when trylock fails it pushes
+ *	the block on the lock-free remote_free stack of the arena with one compare-and-swap. The next thread
+ *	to allocate or free in the arena under the lock takes the whole stack with one exchange, and only then
+ *	coalesces the blocks and puts them back in free_tree. mm_stats and an exiting thread (for its arena)
+ *	drain the stack too, so the blocks of an arena with no thread left do not stay there. The stack is only
+ *	drained on entry to these calls, never while free_block or quick_flush is running.
+ *
+ *	mm_malloc_batch allocates n blocks of one size with a single find_fit: it places one block n times
+ *	as big and cuts it into n blocks. mm_free_batch sorts the blocks by address and frees each run
+ *	of adjacent blocks as one block, so the run is coalesced and added to free_tree once.
+ *
+ *	mm_memalign (and mm_posix_memalign, mm_aligned_alloc) places a block big enough to hold an aligned
+ *	block after a leading part of at least MINSIZE, frees that leading part again and gives the tail
+ *	back with resize_block, so the slack goes back to free_tree instead of being wasted.
+ *
+ *	A free block whose header has the ZERO bit is known to be all 0 but its first PURGE_KEEP bytes
+ *	(links and stamp) and its footer. extend_heap sets it on the fresh memory of an arena region
+ *	(and of mem_sbrk when MEM_SBRK_ZERO), place passes it on to the rest it splits off, and
+ *	coalesce keeps it only when all the merged blocks have it, clearing the words at the seams.
+ *	mm_calloc then clears just those few words instead of the whole block, so fresh pages stay untouched.
+ *
+ *	mm_stats fills an mm_stats_t (mm.h) with the heap, slab and mapping sizes, the bytes in use,
+ *	the free bytes by power of 2 class, the free_tree nodes, the largest free block and the fragmentation
+ *	ratio, and the extend_heap, coalesce case, realloc copy and lock contention counters. The counters are kept all the time
+ *	with plain increments under the arena lock or relaxed atomics; the free blocks are walked on request.
+ *
+ *	Building with -DMM_TLSF replaces free_tree by a two-level segregated fit index.
+ *	Each power of 2 size range is split into SL_COUNT lists; fl_bitmap marks the non-empty ranges
+ *	and sl_bitmap[fl] the non-empty lists of a range. find_fit rounds the size up to the next list
+ *	and finds the first non-empty list with two find-first-set operations, and add_node/delete_node
+ *	only push/unlink the block, so every operation takes constant time whatever the free sizes are.
+ *	The list of the size itself is never searched: when no bigger list has a block, the heap is extended,
+ *	even if that list holds a block big enough.
+ *	In this build a free block only uses LEFT (prev) and RIGHT (next) as the links of its list.
+ *
+ *  Tracing and checking are chosen when building: -DMM_TRACE prints every step on stderr, and -DMM_CHECK checks
+ *	the blocks on the way and the whole heap (mm_check) before each allocation, aborting at the first violation.
+ *	Without them no trace or check code is compiled into the hot paths.
+ *	mm_checkheap runs the checker over every arena in any build and returns the MM_CHECK code (mm.h) of the
+ *	first violation: block size, alignment and footer, PREV_ALLOC bits, adjacent free blocks, free_tree order
+ *	and parent links (or the TLSF lists and bitmaps), same-size list links, and the free block count.
  *
- *  We control the check program by two variables: showflag and checkflag. 
- *	Only when these two are set to 1, the check few program can operate. 
- *	So we don't need to put them into comments.
+ *	make builds the allocator with memlib.c, a stand-in for the malloc lab memory system whose mem_sbrk
+ *	moves a break in one 4GB PROT_NONE reservation (so MEM_SBRK_ZERO is 1), and the benchmarks of bench/.
+ *	bench/mdriver replays the traces of bench/traces (a id size, f id, r id size), synthetic ones written
+ *	by bench/gentrace and ones recorded from real programs, and prints the requests of each kind,
+ *	the ops/sec and the peak utilization of each trace; make bench runs it over all of them.
+ *	bench/mtbench runs thread scaling workloads (larson, producer/consumer, ping-pong, shared slots)
+ *	with 1 to N threads and prints ops/sec, RSS and lock_contended; bench/mtbench-libc runs them on
+ *	the C library malloc.
+ *	bench/latbench times every mm_malloc, mm_free and mm_realloc call of the traces (or of a random churn)
+ *	with the cycle counter into HDR-style histograms, and prints p50, p99, p99.9 and max per size class.
+ *	tests/check replays call sequences which once broke the heap and runs mm_checkheap after them; make check runs it.
+ *
+ *	libmm.so (malloc_preload.c and malloc_new.cc) exports malloc, free, calloc, realloc, the aligned
+ *	allocations, malloc_usable_size (mm_usable_size) and the C++ operators, so LD_PRELOAD=./libmm.so runs
+ *	a program on this allocator. It sets the heap up on the first call, registers mm_fork_prepare,
+ *	mm_fork_parent and mm_fork_child with pthread_atfork, grows the main heap in its own mmap reservation
+ *	instead of memlib, and keeps the 16 bytes alignment glibc gives on x86-64.
  *
  *	Team member:
  *	Xiangtai Hou, netID: xhb083
@@ -39,15 +159,20 @@
  *        bp
  *        |
  *  ======================================================
- * | HEAD |   PAYLOAD                                | FOOT |
+ * | HEAD |   PAYLOAD                                       |
  *  ======================================================
  *
  */    
+#define _GNU_SOURCE// mremap
 #include <stdio.h>    
 #include <stdlib.h>    
 #include <assert.h>    
 #include <unistd.h>    
 #include <string.h>    
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
     
 #include "mm.h"    
 #include "memlib.h"    
@@ -73,24 +198,129 @@ team_t team = {
 #define WSIZE 4   
 #define DSIZE 8   
 #define CHUNKSIZE (1<<10)//Page size in bytes
+#define GROW_MAX ((size_t)64<<10)// the extend_heap step doubles from CHUNKSIZE up to this
 #define MINSIZE 24
+#define MAXSIZE (0xFFFFFFFFU&~0x7)// the size of a block has to fit in its 4 bytes header
+
+// Arenas: threads are spread round-robin over up to MAX_ARENAS arenas
+#define MAX_ARENAS 16
+#define ARENA_REGION ((size_t)1<<30)
+
+// Slabs: sizes up to SLAB_MAX are served from SLAB_SIZE slabs of same-class objects,
+// carved from a SLAB_REGION bytes mapping reserved by the first mm_init
+#define SLAB_SIZE 4096
+#define SLAB_MAX 512
+#define SLAB_CLASSES 16
+#define SLAB_REGION ((size_t)1<<30)
+#define SLAB_OF(bp) ((slab_t *)((size_t)(bp)&~(size_t)(SLAB_SIZE-1)))
+#define IS_SLAB(bp) ((char *)(bp) >= slab_lo && (char *)(bp) < slab_hi)
+
+// Blocks of at least mmap_threshold bytes get their own mapping, which mm_free unmaps at once.
+// The threshold starts at MMAP_THRESHOLD and follows the sizes freed up to MMAP_THRESHOLD_MAX
+#define MMAP_THRESHOLD ((size_t)128<<10)
+#define MMAP_THRESHOLD_MAX ((size_t)32<<20)
+#define MMAP_HEAD 16// a mapped block starts with its length, bp is 16 bytes in
+#define MMAPPED 0x4// bit 2 of the header of a mapped block
+#define IS_MMAPPED(bp) (GET(HEAD(bp))&MMAPPED)
+#define MMAP_LEN(bp) (*(size_t *)((char *)(bp)-MMAP_HEAD))
+
+// Purging: the pages inside a free block of at least 2 pages are given back with madvise
+// once the block has stayed free for purge_decay ms. The check runs every PURGE_TICKS frees and on extend_heap
+#define PURGE_DECAY 10000
+#define PURGE_TICKS 64
+#define PURGED 0xFFFFFFFFU// stamp of a block whose pages are already given back
+#define STAMP(bp) ((void *)(bp)+(WSIZE<<2))// the word after BROS: when the block became free, in ms
+#define PURGE_KEEP ((WSIZE<<2)+WSIZE)// the links and the stamp stay in the first page
+
+// Deferred coalescing: a freed heap block of up to QUICK_MAX bytes goes on the quick list of its exact size
+// and stays allocated to its neighbours. All the lists are coalesced into free_tree when find_fit misses,
+// a list holds more than QUICK_DEPTH blocks or the lists hold more than QUICK_BUDGET bytes
+#define QUICK_MAX 1024
+#define QUICK_DEPTH 16
+#define QUICK_BUDGET (32<<10)
+#define QUICK_LISTS ((QUICK_MAX-MINSIZE)/DSIZE+1)
+#define QUICK_INDEX(size) (((size)-MINSIZE)/DSIZE)
+
+// Known-zero: bit 2 of the header of a free block (MMAPPED is only used in allocated blocks)
+// tells that all its bytes but the first PURGE_KEEP and the footer are 0, as in fresh memory from extend_heap
+#define ZERO 0x4
+#define IS_ZERO(bp) (GET(HEAD(bp))&ZERO)
+// When two known-zero blocks merge, clear the footer and the header before the second one and its links
+#define CLEAR_SEAM(bp) (memset((char *)(bp)-DSIZE,0,DSIZE+PURGE_KEEP))
+// mem_sbrk hands out zeroed memory when memlib.h says so, the regions of the other arenas always do
+#ifndef MEM_SBRK_ZERO
+#define MEM_SBRK_ZERO 0
+#endif
+#define HEAP_ZERO(ar) ((ar)->heap_end != NULL || MEM_SBRK_ZERO)
+
+// Take an arena lock or slab_lock, counting in lock_contended the times another thread held it
+#define LOCK(m) do { \
+        if (pthread_mutex_trylock(m) != 0) { \
+            __atomic_fetch_add(&lock_contended,1,__ATOMIC_RELAXED); \
+            pthread_mutex_lock(m); \
+        } \
+    } while (0)
+
+// Thread cache: max objects per size class, objects moved at once between the cache and the slabs
+#define TC_DEPTH 32
+#define TC_BATCH 16
+  
+// Two-level segregated fit index (build with -DMM_TLSF):
+// SL_COUNT second-level lists per power of 2, first level 0 holds the sizes below 1<<FL_SHIFT
+#define SL_LOG 4
+#define SL_COUNT (1<<SL_LOG)
+#define FL_SHIFT (SL_LOG+3)
+#define FL_COUNT (32-FL_SHIFT+1)
+// Index of the most significant bit
+#define FLS(x) ((int)(sizeof(unsigned long)*8-1-__builtin_clzl((unsigned long)(x))))
   
+// Build with -DMM_TRACE to print every step on stderr, out of the way of the program's stdout, and with -DMM_CHECK to check the blocks on the way
+// and the whole heap before each allocation, aborting at the first violation.
+// Otherwise the calls compile to nothing
+#ifdef MM_TRACE
+#define TRACE(...) fprintf(stderr,__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
+#ifdef MM_CHECK
+#define CHECK_BLOCK(bp) (checkblock(bp) == 0 ? (void)0 : abort())
+#define CHECK_HEAP(ar)  (mm_check(ar) == 0 ? (void)0 : abort())
+#else
+#define CHECK_BLOCK(bp) ((void)0)
+#define CHECK_HEAP(ar)  ((void)0)
+#endif
+
 // Define the alignment, single word(4) or double word(8) alignment
 #define ALIGNMENT 8 
 
 // Get the maximum number of two numbers
 #define MAX(x,y) ((x)>(y)? (x): (y))  
+#define MIN(x,y) ((x)<(y)? (x): (y))
   
-// Read and write a value from the address p
-#define GET(p)     (*(size_t *)(p))  
-#define PUT(p,val) (*(size_t *)(p)=(val))  
+// Read and write a word (4 bytes) at the address p
+#define GET(p)     (*(unsigned int *)(p))  
+#define PUT(p,val) (*(unsigned int *)(p)=(unsigned int)(val))  
   
 // Get the size of the block from the header p of the block
 #define GET_SIZE(p)  ((GET(p))&~0x7)  
 #define GET_ALLOC(p) (GET(p)&0x1)  
+#define GET_PREV_ALLOC(p) (GET(p)&PREV_ALLOC)  
+
+// Bit 1 of a header is set when the previous block is allocated,
+// so only free blocks need a footer for coalesce to find them
+#define PREV_ALLOC 0x2
+#define SET_PREV_ALLOC(bp)   (PUT(HEAD(bp),GET(HEAD(bp))|PREV_ALLOC))
+#define CLEAR_PREV_ALLOC(bp) (PUT(HEAD(bp),GET(HEAD(bp))&~PREV_ALLOC))
 
 // Pack a size and allocated bit into a word
 #define PACK(size,alloc) ((size)|(alloc))  
+
+// A link is a word holding the signed offset of a block from the block bp holding the link, in units of ALIGNMENT,
+// so it does not depend on which arena the block is in.
+// 0 is the null link and LIST_MARK marks a block in a same-size list
+#define LIST_MARK 0xFFFFFFFFU
+#define TO_OFF(bp,p)   ((p) == NULL ? 0U : (unsigned int)(int)(((char *)(p)-(char *)(bp))/ALIGNMENT))
+#define TO_PTR(bp,off) ((off) == 0 ? NULL : (void *)((char *)(bp)+(long)(int)(off)*ALIGNMENT))
   
 // Get information from the pointer bp
 // bp points to the the place right after the Head of the block
@@ -103,21 +333,34 @@ team_t team = {
 //Get bp 
 #define GET_HEAD(bp) (GET(HEAD(bp)))
 #define GET_FOOT(bp) (GET(FOOT(bp)))
-#define GET_PART(bp) (GET(PART(bp)))
-#define GET_BROS(bp) (GET(BROS(bp)))
-#define GET_LEFT_CHILD(bp)  (GET(LEFT(bp)))
-#define GET_RIGHT_CHILD(bp) (GET(RIGHT(bp)))
+#define GET_PART(bp) (TO_PTR(bp,GET(PART(bp))))
+#define GET_BROS(bp) (TO_PTR(bp,GET(BROS(bp))))
+#define GET_LEFT_CHILD(bp)  (TO_PTR(bp,GET(LEFT(bp))))
+#define GET_RIGHT_CHILD(bp) (TO_PTR(bp,GET(RIGHT(bp))))
+#define GET_PREV_FREE(bp) GET_LEFT_CHILD(bp)
+#define GET_NEXT_FREE(bp) GET_RIGHT_CHILD(bp)
+#define IS_LIST_NODE(bp) (GET(RIGHT(bp)) == LIST_MARK)
 //Set bp
-#define PUT_HEAD(bp,val) (PUT(HEAD(bp),(int)val))
-#define PUT_FOOT(bp,val) (PUT(FOOT(bp),(int)val))
-#define PUT_PART(bp,val) (PUT(PART(bp),(int)val))  
-#define PUT_BROS(bp,val) (PUT(BROS(bp),(int)val))
-#define PUT_LEFT_CHILD(bp,val)  (PUT(LEFT(bp),(int)val))
-#define PUT_RIGHT_CHILD(bp,val) (PUT(RIGHT(bp),(int)val))
+#define PUT_HEAD(bp,val) (PUT(HEAD(bp),val))
+#define PUT_FOOT(bp,val) (PUT(FOOT(bp),val))
+#define PUT_PART(bp,val) (PUT(PART(bp),TO_OFF(bp,val)))  
+#define PUT_BROS(bp,val) (PUT(BROS(bp),TO_OFF(bp,val)))
+#define PUT_LEFT_CHILD(bp,val)  (PUT(LEFT(bp),TO_OFF(bp,val)))
+#define PUT_RIGHT_CHILD(bp,val) (PUT(RIGHT(bp),TO_OFF(bp,val)))
+#define PUT_PREV_FREE(bp,val) PUT_LEFT_CHILD(bp,val)
+#define PUT_NEXT_FREE(bp,val) PUT_RIGHT_CHILD(bp,val)
+#define PUT_LIST_MARK(bp) (PUT(RIGHT(bp),LIST_MARK))
 
 // Rounds up to the nearest multiple of Alignment
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
-#define SIZE_T_SIZE (((size) + (ALIGNMENT - 1)) & ~0x7) 
+
+// Heap block sizes are multiples of BLOCK_ALIGN; libmm.so keeps the 16 bytes alignment of the C library
+#ifdef MM_PRELOAD
+#define BLOCK_ALIGN 16
+#else
+#define BLOCK_ALIGN ALIGNMENT
+#endif
+#define BLOCK_ROUND(size) (((size)+(BLOCK_ALIGN-1))&~(size_t)(BLOCK_ALIGN-1))
     
 // Given block bp, compute address of next and previous blocks
 #define PREV_BLKP(bp) ((void *)(bp)-GET_SIZE(((void *)(bp)-DSIZE)))  
@@ -126,139 +369,718 @@ team_t team = {
   
 
 
+typedef struct arena arena_t;
+
 int mm_init ();  
 void *mm_malloc (size_t size);  
 void mm_free (void *bp);  
+void mm_free_sized (void *bp,size_t size);
 void *mm_realloc (void *bp,size_t size);  
+void *mm_calloc (size_t nmemb,size_t size);
+void mm_set_mmap_threshold (size_t size);
+void mm_set_purge_decay (long ms);
+void mm_set_arenas (int n);
+void mm_stats (mm_stats_t *st);
+int mm_checkheap ();
+size_t mm_usable_size (void *bp);
+void *mm_malloc_at_least (size_t size,size_t *actual);
+void mm_fork_prepare ();
+void mm_fork_parent ();
+void mm_fork_child ();
+size_t mm_malloc_batch (size_t size,size_t n,void **out);
+void mm_free_batch (void **ptrs,size_t n);
+void *mm_memalign (size_t alignment,size_t size);
+int mm_posix_memalign (void **memptr,size_t alignment,size_t size);
+void *mm_aligned_alloc (size_t alignment,size_t size);
 
-static void *coalesce (void *bp);
-static void *extend_heap (size_t size);
+static int arena_init (arena_t *ar);
+static void *arena_sbrk (arena_t *ar,size_t size);
+static arena_t *arena_create (int i);
+static arena_t *arena_get ();
+static arena_t *arena_of (void *bp);
 
-static void *find_fit (size_t asize);
-static void place (void *ptr,size_t asize);  
+static void *coalesce (arena_t *ar,void *bp);
+static void *extend_heap (arena_t *ar,size_t size);
 
-static void add_node (void *bp);
-static void delete_node (void *bp); 
+static void *find_fit (arena_t *ar,size_t asize);
+static int place (arena_t *ar,void *ptr,size_t asize);  
+static void *resize_block (arena_t *ar,void *bp,size_t asize);
 
-static void checkblock(void *bp);  
-static void mm_check();  
+static void add_node (arena_t *ar,void *bp);
+static void delete_node (arena_t *ar,void *bp); 
+#ifdef MM_TLSF
+static void tlsf_mapping (size_t size,int *fl,int *sl);
+#endif
+
+static size_t adjust_size (size_t size);
+static void *alloc_block (arena_t *ar,size_t asize,int *zero);
+static void *align_block (arena_t *ar,size_t alignment,size_t asize);
+static void free_block (arena_t *ar,void *bp);
+static void quick_free (arena_t *ar,void *bp);
+static void quick_flush (arena_t *ar);
+static void remote_push (arena_t *ar,void *bp);
+static void remote_drain (arena_t *ar);
+static int addr_cmp (const void *a,const void *b);
+
+static int slab_class (size_t size);
+static void *slab_alloc (arena_t *ar,int cls);
+static void slab_free (void *bp);
+
+static void *mmap_alloc (size_t size);
+static void mmap_free (void *bp);
+static void *mremap_block (void *bp,size_t size);
+
+static unsigned int purge_clock ();
+static void purge_tick (arena_t *ar);
+static size_t purge_block (void *bp,unsigned int now);
+static size_t purge_index (arena_t *ar,unsigned int now);
+#ifndef MM_TLSF
+static void *tree_next (arena_t *ar,void *node);
+#endif
+static void stats_index (arena_t *ar,mm_stats_t *st);
+static void stats_free (mm_stats_t *st,size_t size);
+
+static int tc_refill (int idx);
+static void tc_flush (int idx,unsigned int n);
+static void tc_push (int idx,void *bp);
+static void tc_destroy (void *arg);
+static void tc_make_key ();
+static void tc_attach ();
+
+static int checkblock(void *bp);  
+static int mm_check(arena_t *ar);  
+static int check_index(arena_t *ar,size_t nfree);
+static int check_fail(int err,const char *what,void *bp);
   
-static void *heap_listp = 0;  
-static void *free_tree = 0;//free tree
+// An arena is a heap with its own free index, slabs and lock.
+// main_arena grows with mem_sbrk, the others live in ARENA_REGION regions aligned to their size
+// which start with their arena_t, so the arena of a block is found from its address
+struct arena {
+    pthread_mutex_t lock;// protects the fields below and the blocks of the arena
+    void *heap_listp;// bp of the first block, NULL until the heap is set up
+    char *heap_lo;// the heap is [heap_lo,heap_hi), heap_hi is read with __atomic by arena_of
+    char *heap_hi;
+    char *heap_end;// end of the region, NULL for main_arena
+    char *heap_commit;// end of the readable and writable pages of the region, the rest is PROT_NONE
+    size_t grow;// next extend_heap step, doubled by each extend_heap and halved when a purge pass gives pages back
+    void *free_tree;//free tree
+#ifdef MM_TLSF
+    unsigned int fl_bitmap;// bit fl is set when some list of first level fl is not empty
+    unsigned int sl_bitmap[FL_COUNT];// bit sl of sl_bitmap[fl] is set when free_lists[fl][sl] is not empty
+    void *free_lists[FL_COUNT][SL_COUNT];
+#endif
+    struct slab *slab_partial[SLAB_CLASSES];// slabs which have both free and allocated objects
+    void *remote_free;// blocks freed by threads of other arenas, linked through bp, pushed with __atomic
+    size_t slab_used;// bytes of the allocated objects in the slabs of the arena
+    size_t extend_count;// extend_heap calls
+    size_t coalesce_count[4];// coalesce calls by case
+    void *quick[QUICK_LISTS];// blocks freed without coalescing, by exact size, linked through bp
+    unsigned char quick_count[QUICK_LISTS];
+    size_t quick_bytes;// bytes of the blocks in the quick lists
+    unsigned int purge_ticks;
+    unsigned int purge_last;// purge_clock of the last purge pass
+};
+
+#define ARENA_HEAD ((sizeof(arena_t)+15)&~(size_t)15)
+
+static arena_t main_arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static arena_t *arenas[MAX_ARENAS] = { &main_arena };// the other arenas are mapped on first use
+static int narenas = 1;// number of arenas the threads are spread over
+static int narenas_fixed = 0;// set by mm_set_arenas
+static unsigned int next_arena = 0;// round-robin counter, read and written with __atomic
+static unsigned int arena_gen = 0;// bumped by mm_init, threads pick their arena again when it changes
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;// protects arenas[] and the setup of an arena
+
+// A slab is SLAB_SIZE aligned and starts with this header, the objects follow it
+typedef struct slab {
+    struct slab *next;// next slab in the partial list of its class, or in the empty list
+    struct slab *prev;
+    void *free;// free objects of this slab, linked through their first word
+    arena_t *arena;// arena whose lock protects the slab while it is not in the empty list
+    unsigned short cls;
+    unsigned short used;// number of allocated objects
+} slab_t;
+
+#define SLAB_HEAD ((sizeof(slab_t)+15)&~(size_t)15)
+
+// Object size of each slab class: 16 bytes steps up to 128, then 4 steps per power of 2
+static const unsigned short slab_size[SLAB_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+static char *slab_lo = 0;// slab region [slab_lo,slab_end), slabs are carved up to slab_hi
+static char *slab_hi = 0;
+static char *slab_end = 0;
+static slab_t *slab_empty = 0;// slabs with no allocated object, ready for any class and arena
+// slab_lock protects slab_hi and slab_empty, it is taken inside the lock of an arena
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t page_size = 4096;
+static size_t commit_size = 4096;// the heap regions are committed and purged by this, a page or a huge page (MM_THP)
+static size_t mmap_threshold = MMAP_THRESHOLD;// read and written with __atomic, mm_free may raise it
+static int mmap_threshold_fixed = 0;// set by mm_set_mmap_threshold, the threshold does not move any more
+
+static size_t mmap_bytes = 0;// bytes and number of the mappings of large blocks, read and written with __atomic
+static size_t mmap_blocks = 0;
+static size_t realloc_copied = 0;// bytes mm_realloc copied, read and written with __atomic
+static size_t lock_contended = 0;// LOCK calls which found the lock held, read and written with __atomic
+
+static long purge_decay = PURGE_DECAY;// ms a free block stays dirty, -1 never purges, read and written with __atomic
+static struct timespec purge_epoch;// purge_clock counts from here
+
+// Per-thread cache of free slab objects, one LIFO list per slab class
+typedef struct {
+    void *head[SLAB_CLASSES];
+    unsigned int count[SLAB_CLASSES];
+    int state;// 0: not registered yet, 1: registered for flush on exit, -1: thread is exiting
+    arena_t *arena;// arena of this thread, NULL until its first allocation
+    unsigned int gen;// arena_gen when the arena was picked
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tc_key;
+static pthread_once_t tc_once = PTHREAD_ONCE_INIT;
 
-static size_t flag = 0;  //control flag
-static int showflag = 0;// When the showflag = 1, print the entry information
-static int checkflag = 0;// When the checkflag = 1, active those check functions
 
  
   
 /* 
  * mm_init - initialize the malloc package.
- * call function extend_heap
+ * set up main_arena, the other arenas set up their heap again when they are used next
+ * call function arena_init
  */ 
 int mm_init()  
 {  
+	int ret = 0;
+    int i = 0;
+    long ncpu = 0;
+    arena_t *ar = NULL;
+    char *start = NULL;
 	
-    free_tree = NULL;
+    pthread_mutex_lock(&arenas_lock);
+    pthread_mutex_lock(&main_arena.lock);
+    // blocks cached by this thread belong to the old heap
+    memset(tcache.head,0,sizeof(tcache.head));
+    memset(tcache.count,0,sizeof(tcache.count));
+    tcache.arena = NULL;
+    
+    page_size = sysconf(_SC_PAGESIZE);
+    commit_size = MEM_COMMIT_UNIT(page_size);
+    clock_gettime(CLOCK_MONOTONIC,&purge_epoch);
+    if (!mmap_threshold_fixed)
+        __atomic_store_n(&mmap_threshold,MMAP_THRESHOLD,__ATOMIC_RELAXED);
+    
+    // one arena per CPU
+    if (!narenas_fixed)
+    {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        __atomic_store_n(&narenas,(ncpu < 1) ? 1 : (ncpu > MAX_ARENAS) ? MAX_ARENAS : (int)ncpu,__ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&arena_gen,1,__ATOMIC_RELAXED);
+    
+    // the regions of the other arenas are kept, only their heaps are dropped and their pages decommitted,
+    // zeroed again for known-zero: the heap starts in the page of the arena_t, which must stay committed
+    for (i = 1; i < MAX_ARENAS; i++)
+        if ((ar = arenas[i]) != NULL && ar->heap_listp != NULL)
+        {
+            start = (char *)(((size_t)ar->heap_lo+commit_size-1)&~(commit_size-1));
+            memset(ar->heap_lo,0,MIN(start,ar->heap_hi)-ar->heap_lo);
+            if (start < ar->heap_commit)
+            {
+                madvise(start,ar->heap_commit-start,MADV_DONTNEED);
+                mprotect(start,ar->heap_commit-start,PROT_NONE);
+                ar->heap_commit = start;
+            }
+            ar->remote_free = NULL;
+            ar->heap_listp = NULL;
+        }
+    
+    // the slab region is kept, only its slabs are dropped
+    if (slab_lo == NULL)
+    {
+        slab_lo = mmap(NULL,SLAB_REGION,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+        if (slab_lo == MAP_FAILED)
+            slab_lo = NULL;// small sizes go to free_tree too
+        else
+            slab_end = slab_lo+SLAB_REGION;
+    }
+    else
+        madvise(slab_lo,slab_hi-slab_lo,MADV_DONTNEED);
+    slab_hi = slab_lo;
+    slab_empty = NULL;
     
     //checkpoint
-    if(showflag == 1){
-		printf("begin to initialize the heap\n");
-	}
+    TRACE("begin to initialize the heap\n");
+	
+    if (arena_init(&main_arena) != 0)  
+        ret = -1;  
+    pthread_mutex_unlock(&main_arena.lock);
+    pthread_mutex_unlock(&arenas_lock);
+	
+	//checkpoint
+	if (ret == 0)
+        TRACE("initialize successfully");
 	
-    if ((heap_listp = mem_sbrk((WSIZE<<2))) == (void*) -1){
+    return ret;  
+}  
+
+/*
+ * arena_init - Set up an empty heap in the arena, with the prologue, the epilogue and a first free chunk
+ * return -1 when there is no memory for it
+ * call function arena_sbrk, extend_heap
+ */
+static int arena_init(arena_t *ar)
+{
+    char *heap_listp = NULL;
+    
+    ar->free_tree = NULL;
+#ifdef MM_TLSF
+    ar->fl_bitmap = 0;
+    memset(ar->sl_bitmap,0,sizeof(ar->sl_bitmap));
+    memset(ar->free_lists,0,sizeof(ar->free_lists));
+#endif
+    memset(ar->slab_partial,0,sizeof(ar->slab_partial));
+    ar->remote_free = NULL;
+    ar->slab_used = 0;
+    ar->extend_count = 0;
+    memset(ar->coalesce_count,0,sizeof(ar->coalesce_count));
+    memset(ar->quick,0,sizeof(ar->quick));
+    memset(ar->quick_count,0,sizeof(ar->quick_count));
+    ar->quick_bytes = 0;
+    ar->purge_ticks = 0;
+    ar->purge_last = 0;
+    ar->grow = CHUNKSIZE;
+    ar->heap_listp = NULL;
+    
+    if (ar->heap_end != NULL)// the region is used again from its start
+        ar->heap_hi = ar->heap_lo;
+    if ((heap_listp = arena_sbrk(ar,(WSIZE<<2))) == (void*) -1)
         return -1;  
-	}
 	
 	// Create the initial empty heap
+    ar->heap_lo = heap_listp;
     PUT(heap_listp,0);						
     PUT(heap_listp+(WSIZE),PACK(DSIZE,1)); //Prologue header//WSIZE*1
     PUT(heap_listp+(WSIZE<<1),PACK(DSIZE,1)); //Prologue footer//WSIZE*2
-	PUT(heap_listp+((WSIZE<<1)+WSIZE),PACK(0,1));     //Epilogue//WSIZE*3
-	
-	
+	PUT(heap_listp+((WSIZE<<1)+WSIZE),PACK(0,PREV_ALLOC|1));     //Epilogue//WSIZE*3
     heap_listp += (WSIZE<<2);  				//heap_listp points to bp of first valid block
-     
+    ar->heap_listp = heap_listp;
     
-	
-    if (extend_heap(CHUNKSIZE) == NULL)  
-        return -1;  
-	
-	//checkpoint
-	if(showflag == 1){
-		printf("initialize successfully");
-	}
-	
-    return 0;  
-}  
+    if (extend_heap(ar,CHUNKSIZE) == NULL)  
+    {
+        ar->heap_listp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * arena_sbrk - Grow the heap of the arena by size bytes, like mem_sbrk,
+ * committing the pages of the region it reaches into
+ * return (void *)-1 when the arena is full or the pages cannot be committed
+ */
+static void *arena_sbrk(arena_t *ar,size_t size)
+{
+    char *old = ar->heap_hi;
+    char *commit = NULL;
+    
+    if (ar->heap_end == NULL)
+    {
+        if ((old = mem_sbrk(size)) == (void *)-1)
+            return old;
+    }
+    else if (size > (size_t)(ar->heap_end-old))
+        return (void *)-1;
+    else if (old+size > ar->heap_commit)
+    {
+        commit = (char *)(((size_t)old+size+commit_size-1)&~(commit_size-1));
+        if (mprotect(ar->heap_commit,commit-ar->heap_commit,PROT_READ|PROT_WRITE) != 0)
+            return (void *)-1;
+        ar->heap_commit = commit;
+    }
+    __atomic_store_n(&ar->heap_hi,old+size,__ATOMIC_RELAXED);
+    return old;
+}
+
+/*
+ * arena_create - Get arena i, map its region the first time and set up its heap the first time
+ * it is used since mm_init.
+ * return main_arena when there is no memory for it
+ */
+static arena_t *arena_create(int i)
+{
+    arena_t *ar = NULL;
+    char *region = NULL;
+    size_t head = (ARENA_HEAD+commit_size-1)&~(commit_size-1);
+    
+    pthread_mutex_lock(&arenas_lock);
+    if ((ar = arenas[i]) == NULL)
+    {
+        // arena_sbrk commits the pages of the region as the heap grows
+        region = mem_reserve(ARENA_REGION,ARENA_REGION);
+        if (region == MAP_FAILED)
+        {
+            pthread_mutex_unlock(&arenas_lock);
+            return &main_arena;
+        }
+        if (mprotect(region,head,PROT_READ|PROT_WRITE) != 0)
+        {
+            munmap(region,ARENA_REGION);
+            pthread_mutex_unlock(&arenas_lock);
+            return &main_arena;
+        }
+        
+        ar = (arena_t *)region;
+        pthread_mutex_init(&ar->lock,NULL);
+        ar->heap_lo = (char *)ar+ARENA_HEAD;
+        ar->heap_hi = ar->heap_lo;
+        ar->heap_end = (char *)ar+ARENA_REGION;
+        ar->heap_commit = (char *)ar+head;
+        arenas[i] = ar;
+    }
+    if (ar->heap_listp == NULL && arena_init(ar) != 0)
+        ar = &main_arena;
+    pthread_mutex_unlock(&arenas_lock);
+    return ar;
+}
+
+/*
+ * arena_get - Get the arena of this thread, each thread picks the next arena round-robin
+ */
+static arena_t *arena_get()
+{
+    unsigned int gen = __atomic_load_n(&arena_gen,__ATOMIC_RELAXED);
+    
+    if (tcache.arena == NULL || tcache.gen != gen)
+    {
+        tcache.gen = gen;
+        tcache.arena = arena_create(__atomic_fetch_add(&next_arena,1,__ATOMIC_RELAXED)
+                                    %__atomic_load_n(&narenas,__ATOMIC_RELAXED));
+    }
+    return tcache.arena;
+}
+
+/*
+ * arena_of - Get the arena of a heap block: main_arena when the block is in the mem_sbrk heap,
+ * otherwise the region the block is in
+ */
+static arena_t *arena_of(void *bp)
+{
+    if ((char *)bp >= main_arena.heap_lo && (char *)bp < __atomic_load_n(&main_arena.heap_hi,__ATOMIC_RELAXED))
+        return &main_arena;
+    return (arena_t *)((size_t)bp&~(ARENA_REGION-1));
+}
+
+/*
+ * mm_set_arenas - Spread the threads over n arenas instead of one per CPU,
+ * every thread picks its arena again on its next allocation
+ */
+void mm_set_arenas(int n)
+{
+    pthread_mutex_lock(&arenas_lock);
+    narenas_fixed = 1;
+    __atomic_store_n(&narenas,(n < 1) ? 1 : (n > MAX_ARENAS) ? MAX_ARENAS : n,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena_gen,1,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+/*
+ * mm_fork_prepare - Take every lock of the allocator before fork, in the usual order,
+ * so the child does not start with a lock held by a thread it does not have.
+ * mm_fork_parent and mm_fork_child release them after fork; register the three with pthread_atfork
+ */
+void mm_fork_prepare()
+{
+    int i = 0;
+    
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 0; i < MAX_ARENAS; i++)
+        if (arenas[i] != NULL)
+            pthread_mutex_lock(&arenas[i]->lock);
+    pthread_mutex_lock(&slab_lock);
+}
+
+void mm_fork_parent()
+{
+    int i = 0;
+    
+    pthread_mutex_unlock(&slab_lock);
+    for (i = MAX_ARENAS-1; i >= 0; i--)
+        if (arenas[i] != NULL)
+            pthread_mutex_unlock(&arenas[i]->lock);
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+/*
+ * mm_fork_child - Release the locks in the child, which only has the thread that called fork.
+ * The blocks cached by the other threads of the parent stay allocated in the child
+ */
+void mm_fork_child()
+{
+    mm_fork_parent();
+}
 
 /*
  * extend_heap return a block whose size is an integral number of double words
- * insert the block to the free list
+ * insert the block to the free list, coalesced with the free block before it, and return that free block
+ * the heap grows by at least ar->grow bytes, which doubles up to GROW_MAX, so a growing heap
+ * takes few steps; when the arena has no room for a whole step it grows by size alone
  * call the function coalesce and mem_sbrk, add_node
  */
-void *extend_heap(size_t size)
+void *extend_heap(arena_t *ar,size_t size)
 {
-    if(showflag){
-		printf("begin to extend_heap\n");
-	}
+    TRACE("begin to extend_heap\n");
 	void *bp = NULL;
     void *coalesced_bp = 0;
+    size_t step = MAX(size,ar->grow);
     
-    if ((long)(bp=mem_sbrk(size)) == -1){
-        if(showflag)
-        {
-			printf("extend heap unsuccessfully\n");
-		}
+    if ((long)(bp=arena_sbrk(ar,step)) == -1 && (step == size || (long)(bp=arena_sbrk(ar,step=size)) == -1)){
+        TRACE("extend heap unsuccessfully\n");
 		return NULL;
 	}
+    size = step;
+    ar->grow = MIN(ar->grow<<1,GROW_MAX);
     
 	//printf("bp = %p,size = %d\n",bp,size);
 	// Initialize free block header/footer and the epilogue header
-    PUT_HEAD(bp,PACK(size,0));//free block header
+    PUT_HEAD(bp,PACK(size,GET_PREV_ALLOC(HEAD(bp))|(HEAP_ZERO(ar) ? ZERO : 0)));//free block header, keep the bit of the old epilogue
     PUT_FOOT(bp,PACK(size,0));//free block footer
     PUT_HEAD(NEXT_BLKP(bp),PACK(0,1));//new epilogue header
 	
-	if(checkflag == 1){
-		checkblock(bp);
-	}
+	CHECK_BLOCK(bp);
     
 	// Coalesce if the previous block was free
-    coalesced_bp = coalesce(bp);
-    add_node(coalesced_bp);
-	if(showflag){
-		printf("extend heap successfully\n");
-	}
-	if(checkflag == 1){
-		checkblock(coalesced_bp);
-	}
+    ar->extend_count++;
+    coalesced_bp = coalesce(ar,bp);
+    add_node(ar,coalesced_bp);
+    purge_tick(ar);
+	TRACE("extend heap successfully\n");
+	CHECK_BLOCK(coalesced_bp);
 	
+    return coalesced_bp;
+}
+
+/*
+ * mm_free - Put a slab object into this thread's cache, flush part of the cache when it is full,
+ * otherwise add the block to the free_tree of its arena, or to its remote queue when it is another thread's arena
+ * call function arena_of, remote_push, remote_drain, free_block, tc_flush, slab_free
+ */
+void mm_free(void *bp)
+{
+    arena_t *ar = NULL;
+    
+    if (bp == NULL)
+        return;
+    
+    if (IS_SLAB(bp))
+    {
+        int idx = SLAB_OF(bp)->cls;
+        
+        if (tcache.state >= 0)
+        {
+            tc_push(idx,bp);
+            return;
+        }
+        ar = SLAB_OF(bp)->arena;
+        LOCK(&ar->lock);
+        slab_free(bp);
+        pthread_mutex_unlock(&ar->lock);
+        return;
+    }
+    if (IS_MMAPPED(bp))
+    {
+        mmap_free(bp);
+        return;
+    }
+    
+    // the block goes back to the arena it was allocated from,
+    // a thread of another arena only queues it there when it cannot take the lock at once
+    ar = arena_of(bp);
+    if (ar == tcache.arena || tcache.arena == NULL)
+        LOCK(&ar->lock);
+    else if (pthread_mutex_trylock(&ar->lock) != 0)
+    {
+        remote_push(ar,bp);
+        return;
+    }
+    remote_drain(ar);
+    quick_free(ar,bp);
+    pthread_mutex_unlock(&ar->lock);
+}
+
+/*
+ * mm_free_sized - Free a block whose size the caller knows, as C++ sized delete does.
+ * size must be the size the block was allocated or last reallocated with.
+ * A slab object goes straight to the thread cache list of the class of size without reading
+ * its slab header; other blocks are freed by mm_free. -DMM_CHECK builds check size against the header
+ * call function tc_push, mm_free
+ */
+void mm_free_sized(void *bp,size_t size)
+{
+    int idx = 0;
+    
+    if (bp == NULL)
+        return;
+    
+    if (size <= SLAB_MAX && IS_SLAB(bp) && tcache.state >= 0)
+    {
+        // mm_realloc may have kept the object in a bigger class, such an object can serve the smaller class
+        idx = slab_class(size);
+#ifdef MM_CHECK
+        if (idx > SLAB_OF(bp)->cls && check_fail(MM_CHECK_BLOCK,"sized free bigger than the slab class",bp))
+            abort();
+#endif
+        tc_push(idx,bp);
+        return;
+    }
+#ifdef MM_CHECK
+    if (!(IS_SLAB(bp) ? size <= slab_size[SLAB_OF(bp)->cls] :
+          IS_MMAPPED(bp) ? size <= MMAP_LEN(bp)-MMAP_HEAD : size <= GET_SIZE(HEAD(bp))-WSIZE) &&
+        check_fail(MM_CHECK_BLOCK,"sized free bigger than the block",bp))
+        abort();
+#endif
+    mm_free(bp);
+}
+
+/*
+ * mm_usable_size - Bytes the caller may use at bp, at least the size it was allocated with:
+ * the whole object of a slab, the mapping after MMAP_HEAD, or the heap block but its header
+ */
+size_t mm_usable_size(void *bp)
+{
+    if (bp == NULL)
+        return 0;
+    if (IS_SLAB(bp))
+        return slab_size[SLAB_OF(bp)->cls];
+    if (IS_MMAPPED(bp))
+        return MMAP_LEN(bp)-MMAP_HEAD;
+    return GET_SIZE(HEAD(bp))-WSIZE;
+}
+
+/*
+ * mm_malloc_at_least - Allocate at least size bytes like mm_malloc, and set *actual to the bytes
+ * the caller may use, so a growing buffer can fill the whole block before it reallocates.
+ * A slab object of a small size has the size of the class of size, without reading its slab header
+ * call function mm_malloc, mm_usable_size
+ */
+void *mm_malloc_at_least(size_t size,size_t *actual)
+{
+    void *bp = mm_malloc(size);
+    
+    if (actual != NULL)
+        *actual = (bp == NULL) ? 0 : (size <= SLAB_MAX && IS_SLAB(bp)) ? slab_size[slab_class(size)] : mm_usable_size(bp);
     return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing, and add it to free_tree
+ * free_block - Freeing a block does nothing, and add it to free_tree
+ * the caller must hold the lock of ar
  * call function add_node,
  */
-void mm_free(void *bp)
+static void free_block(arena_t *ar,void *bp)
 {
 	//checkpoint
-    if(showflag ==1)
-		printf("begin to free\n");
+    TRACE("begin to free\n");
     
     size_t size = GET_SIZE(HEAD(bp));
 
-    PUT(HEAD(bp),PACK(size,0));
+    PUT(HEAD(bp),PACK(size,GET_PREV_ALLOC(HEAD(bp))));
     PUT(FOOT(bp),PACK(size,0));//!!!!
+    CLEAR_PREV_ALLOC(NEXT_BLKP(bp));
 	
-    add_node(coalesce(bp));
+    add_node(ar,coalesce(ar,bp));
+    if (++ar->purge_ticks >= PURGE_TICKS)
+        purge_tick(ar);
     //checkpoint
-    if(showflag == 1)
-		printf("free successfully and add it to free_tree successfully\n");
+    TRACE("free successfully and add it to free_tree successfully\n");
 	
 }
 
 
+/*
+ * remote_push - Queue a block freed by a thread of another arena with a single atomic push,
+ * the next thread to take the lock of its arena frees it
+ */
+static void remote_push(arena_t *ar,void *bp)
+{
+    void *head = __atomic_load_n(&ar->remote_free,__ATOMIC_RELAXED);
+    
+    do
+        *(void **)bp = head;
+    while (!__atomic_compare_exchange_n(&ar->remote_free,&head,bp,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+}
+
+/*
+ * remote_drain - Take the whole remote queue of ar at once and free its blocks
+ * the caller must hold the lock of ar
+ * call function free_block
+ */
+static void remote_drain(arena_t *ar)
+{
+    void *bp = NULL, *next = NULL;
+    
+    if (__atomic_load_n(&ar->remote_free,__ATOMIC_RELAXED) == NULL)
+        return;
+    bp = __atomic_exchange_n(&ar->remote_free,NULL,__ATOMIC_ACQUIRE);
+    for ( ; bp != NULL; bp = next)
+    {
+        next = *(void **)bp;
+        quick_free(ar,bp);
+    }
+}
+
+/*
+ * quick_free - Free a heap block freed by the program: a block of up to QUICK_MAX bytes is pushed
+ * on the quick list of its size as it is, without coalescing; when the list gets longer than QUICK_DEPTH
+ * or the lists hold more than QUICK_BUDGET bytes, all the lists are coalesced. Bigger blocks are freed by free_block
+ * the caller must hold the lock of ar
+ * call function free_block, quick_flush
+ */
+static void quick_free(arena_t *ar,void *bp)
+{
+    size_t size = GET_SIZE(HEAD(bp));
+    int idx = 0;
+    
+    if (size > QUICK_MAX)
+    {
+        free_block(ar,bp);
+        return;
+    }
+    idx = QUICK_INDEX(size);
+    *(void **)bp = ar->quick[idx];
+    ar->quick[idx] = bp;
+    ar->quick_bytes += size;
+    if (++ar->quick_count[idx] > QUICK_DEPTH || ar->quick_bytes > QUICK_BUDGET)
+        quick_flush(ar);
+}
+
+/*
+ * quick_flush - Free the blocks of every quick list with free_block, so they are coalesced and added to free_tree.
+ * Each list is detached before it is walked, so a block pushed meanwhile is not lost
+ * the caller must hold the lock of ar
+ */
+static void quick_flush(arena_t *ar)
+{
+    void *bp = NULL, *next = NULL;
+    int idx = 0;
+    
+    if (ar->quick_bytes == 0)
+        return;
+    for (idx = 0; idx < QUICK_LISTS; idx++)
+    {
+        bp = ar->quick[idx];
+        ar->quick[idx] = NULL;
+        ar->quick_count[idx] = 0;
+        for ( ; bp != NULL; bp = next)
+        {
+            ar->quick_bytes -= GET_SIZE(HEAD(bp));
+            next = *(void **)bp;
+            free_block(ar,bp);
+        }
+    }
+}
+
+
 /*
  * coalesce function
  * we choose free list format with prologue and no epilogue blocks that are always marked as allocated
@@ -266,27 +1088,21 @@ void mm_free(void *bp)
  * call delete node
  */
 
-static void *coalesce(void *bp)
+static void *coalesce(arena_t *ar,void *bp)
 {
-	if(showflag ==1){
-		printf("begin to coalesce\n");
-	}
-    size_t prev_alloc = GET_ALLOC(HEAD(PREV_BLKP(bp)));
+	TRACE("begin to coalesce\n");
+    size_t prev_alloc = GET_PREV_ALLOC(HEAD(bp));
 	size_t next_alloc = GET_ALLOC(HEAD(NEXT_BLKP(bp)));
     size_t bsize = GET_SIZE(HEAD(bp));
-    void *prev_block = PREV_BLKP(bp);
+    void *prev_block = prev_alloc ? NULL : PREV_BLKP(bp);// only a free block has a footer
     void *next_block = NEXT_BLKP(bp);
+    unsigned int zero = IS_ZERO(bp);// the merged block is known-zero when all its parts are
     int ca=0;
 	
     //checkpoint
-	if(checkflag == 1){
-		printf("check the prev_block\n");
-		checkblock(prev_block);
-		printf("check the current block\n");
-		checkblock(bp);
-		printf("check the next_block\n");
-		checkblock(next_block);
-	}
+	CHECK_BLOCK(prev_block);
+	CHECK_BLOCK(bp);
+	CHECK_BLOCK(next_block);
     
     if (prev_alloc && next_alloc)
         ca = 1;
@@ -296,182 +1112,948 @@ static void *coalesce(void *bp)
         ca = 3;
     else
         ca = 4;
+    ar->coalesce_count[ca-1]++;
     
     switch (ca)
     {
         case 1:// case 1 prev and next are allocated
-            if(showflag == 1){
-                printf("case1: coalesce successfully\n");
-            }
+            TRACE("case1: coalesce successfully\n");
             return bp;
         case 2://case 2 prev is allocated and next is free
             //checkpoint
-            if(showflag == 1){
-                printf("coalesce_case2\n");
-            }
+            TRACE("coalesce_case2\n");
             bsize += GET_SIZE(HEAD(next_block));
-            delete_node(next_block);
-            PUT_HEAD(bp,PACK(bsize,0));
+            delete_node(ar,next_block);
+            if ((zero &= IS_ZERO(next_block)) != 0)
+                CLEAR_SEAM(next_block);
+            PUT_HEAD(bp,PACK(bsize,PREV_ALLOC|zero));
             PUT_FOOT(bp,PACK(bsize,0));
             //checkpoint
-            if(showflag == 1){
-                printf("case2: coalesce successfully\n");
-            }
+            TRACE("case2: coalesce successfully\n");
             //checkpoint
-            if(checkflag == 1){
-                checkblock(bp);
-            }
+            CHECK_BLOCK(bp);
             
             return bp;
         case 3://case 3 prev is free and next is allocated
             //checkpoint
-            if(showflag == 1){
-                printf("coalesce_case3\n");
-            }
+            TRACE("coalesce_case3\n");
             bsize += GET_SIZE(HEAD(prev_block));
-            delete_node(prev_block);
-            PUT_HEAD(prev_block,PACK(bsize,0));
-            PUT_FOOT(bp,PACK(bsize,0));
+            delete_node(ar,prev_block);
+            if ((zero &= IS_ZERO(prev_block)) != 0)
+                CLEAR_SEAM(bp);
+            PUT_HEAD(prev_block,PACK(bsize,GET_PREV_ALLOC(HEAD(prev_block))|zero));
+            PUT_FOOT(prev_block,PACK(bsize,0));// the header of bp may be cleared
             
             //checkpoint
-            if(showflag == 1){
-                printf("case3: coalesce successfully\n");
-            }
+            TRACE("case3: coalesce successfully\n");
             //checkpoint
-            if(checkflag == 1){
-                checkblock(prev_block);
-            }
+            CHECK_BLOCK(prev_block);
             
             return prev_block;
         case 4://case 4 prev and next are both free
             //checkpoint
-            if(showflag == 1){
-                printf("coalesce_case4\n");
-            }
+            TRACE("coalesce_case4\n");
             bsize += GET_SIZE(HEAD(prev_block))+GET_SIZE(HEAD(next_block));
-            delete_node(next_block);
-            delete_node(prev_block);
-            PUT_HEAD(prev_block,PACK(bsize,0));
-            PUT_FOOT(next_block,PACK(bsize,0));
+            delete_node(ar,next_block);
+            delete_node(ar,prev_block);
+            if ((zero &= IS_ZERO(prev_block)&IS_ZERO(next_block)) != 0)
+            {
+                CLEAR_SEAM(bp);
+                CLEAR_SEAM(next_block);
+            }
+            PUT_HEAD(prev_block,PACK(bsize,GET_PREV_ALLOC(HEAD(prev_block))|zero));
+            PUT_FOOT(prev_block,PACK(bsize,0));
             
             //checkpoint
-            if(showflag == 1){
-                printf("case4: coalesce successfully\n");
-            }
+            TRACE("case4: coalesce successfully\n");
             //checkpoint
-            if(checkflag == 1){
-                checkblock(prev_block);
-            }
+            CHECK_BLOCK(prev_block);
             
             
             return prev_block;
             
     }
 
+    return bp;// not reached, ca is 1 to 4
+}  
+
+
+/* 
+ * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * Always allocate a block whose size is a multiple of the alignment.
+ * Sizes up to SLAB_MAX are taken from this thread's cache, which is refilled from the slabs,
+ * bigger sizes are allocated from the free_tree of this thread's arena under its lock
+ * call function tc_refill, adjust_size, arena_get, alloc_block
+ */
+void *mm_malloc(size_t size)  
+{
+    //checkpoint
+	TRACE("begin to malloc\n");
+    size_t asize = 0;   
+    void *bp = 0;
+    int idx = 0;
+    arena_t *ar = NULL;
+    
+    //ignore spurious requests, without a word: a library does not write to stdout
+    if (size == 0)
+        return NULL;
+    if (size >= __atomic_load_n(&mmap_threshold,__ATOMIC_RELAXED) && (bp = mmap_alloc(size)) != NULL)
+        return bp;
+    if (size > MAXSIZE-DSIZE)
+        return NULL;
+    
+    if (size <= SLAB_MAX)
+    {
+        idx = slab_class(size);
+        if (tcache.head[idx] != NULL || tc_refill(idx))
+        {
+            bp = tcache.head[idx];
+            tcache.head[idx] = *(void **)bp;
+            tcache.count[idx]--;
+            return bp;
+        }
+        // the slab region is used up, fall back to free_tree
+    }
+    asize = adjust_size(size);
+    
+    ar = arena_get();
+    LOCK(&ar->lock);
+    bp = alloc_block(ar,asize,NULL);
+    pthread_mutex_unlock(&ar->lock);
+    if (bp == NULL && ar != &main_arena)// the region of the arena is full
+    {
+        ar = &main_arena;
+        LOCK(&ar->lock);
+        bp = alloc_block(ar,asize,NULL);
+        pthread_mutex_unlock(&ar->lock);
+    }
+    return bp;
+}  
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out, return the number of blocks allocated.
+ * A heap size takes one block of n times the size with a single find_fit under one lock,
+ * and cuts it into n blocks. Slab and mapped sizes go through mm_malloc one by one
+ * call function mm_malloc, adjust_size, arena_get, alloc_block
+ */
+size_t mm_malloc_batch(size_t size,size_t n,void **out)
+{
+    size_t asize = 0, total = 0, done = 0, k = 0, i = 0;
+    char *bp = NULL;
+    arena_t *ar = NULL;
+    
+    if (size > SLAB_MAX && size < __atomic_load_n(&mmap_threshold,__ATOMIC_RELAXED) && size <= MAXSIZE-DSIZE)
+    {
+        asize = adjust_size(size);
+        ar = arena_get();
+        LOCK(&ar->lock);
+        while (done < n)
+        {
+            k = MIN(n-done,MAXSIZE/asize);
+            if ((bp = alloc_block(ar,k*asize,NULL)) == NULL)
+                break;
+            // place gave a block of at least k*asize, the last block keeps the slack it could not split off.
+            // A block popped from a quick list may follow a free block, the first one keeps its PREV_ALLOC bit
+            total = GET_SIZE(HEAD(bp));
+            for (i = 0; i < k; i++, bp += asize)
+            {
+                PUT_HEAD(bp,PACK((i == k-1) ? total-i*asize : asize,(i == 0 ? GET_PREV_ALLOC(HEAD(bp)) : PREV_ALLOC)|1));
+                out[done++] = bp;
+            }
+        }
+        pthread_mutex_unlock(&ar->lock);
+    }
+    
+    // no room for a whole run is left, take the rest one by one
+    for ( ; done < n && (out[done] = mm_malloc(size)) != NULL; done++)
+        ;
+    return done;
+}
+
+/*
+ * mm_free_batch - Free n blocks; ptrs is reordered.
+ * The heap blocks are sorted by address, and each run of adjacent blocks of the same arena
+ * is freed as one block, so it is coalesced and added to free_tree once
+ * call function mm_free, arena_of, free_block
+ */
+void mm_free_batch(void **ptrs,size_t n)
+{
+    size_t i = 0, j = 0, m = 0, total = 0;
+    arena_t *ar = NULL;
+    
+    // slab objects and mapped blocks have nothing to coalesce, free them now and keep the heap blocks
+    for (i = 0; i < n; i++)
+    {
+        if (ptrs[i] == NULL)
+            continue;
+        if (IS_SLAB(ptrs[i]) || IS_MMAPPED(ptrs[i]))
+            mm_free(ptrs[i]);
+        else
+            ptrs[m++] = ptrs[i];
+    }
+    qsort(ptrs,m,sizeof(void *),addr_cmp);
+    
+    for (i = 0; i < m; i = j)
+    {
+        ar = arena_of(ptrs[i]);
+        LOCK(&ar->lock);
+        for ( ; i < m && arena_of(ptrs[i]) == ar; i = j)
+        {
+            total = GET_SIZE(HEAD(ptrs[i]));
+            for (j = i+1; j < m && ptrs[j] == NEXT_BLKP(ptrs[j-1]) && total+GET_SIZE(HEAD(ptrs[j])) <= MAXSIZE; j++)
+                total += GET_SIZE(HEAD(ptrs[j]));
+            // the run becomes one allocated block, which free_block frees at once
+            PUT_HEAD(ptrs[i],PACK(total,GET_PREV_ALLOC(HEAD(ptrs[i]))|1));
+            free_block(ar,ptrs[i]);
+        }
+        pthread_mutex_unlock(&ar->lock);
+    }
+}
+
+/*
+ * addr_cmp - Order pointers by address for qsort
+ */
+static int addr_cmp(const void *a,const void *b)
+{
+    char *pa = *(char * const *)a, *pb = *(char * const *)b;
+    
+    return (pa > pb)-(pa < pb);
+}
+
+/*
+ * mm_memalign - Allocate size bytes at an address which is a multiple of alignment, a power of 2.
+ * An alignment up to 16 is already met by the slab objects; otherwise the block comes from
+ * the heap of this thread's arena, mapped blocks are never used since their bp is fixed 16 bytes into a page
+ * call function mm_malloc, mm_free, adjust_size, arena_get, align_block
+ */
+void *mm_memalign(size_t alignment,size_t size)
+{
+    void *bp = NULL;
+    arena_t *ar = NULL;
+    
+    if (alignment == 0 || (alignment&(alignment-1)) != 0)
+        return NULL;
+    if (alignment <= BLOCK_ALIGN)
+        return mm_malloc(size);
+    if (size == 0 || alignment > (MAXSIZE>>1) || size > MAXSIZE-DSIZE-MINSIZE-alignment)
+        return NULL;
+    if (alignment <= 16 && size <= SLAB_MAX)
+    {
+        // objects of the slabs are 16 bytes aligned, only a heap block from a full slab region may not be
+        if ((bp = mm_malloc(size)) == NULL || ((size_t)bp&(alignment-1)) == 0)
+            return bp;
+        mm_free(bp);
+    }
+    
+    ar = arena_get();
+    LOCK(&ar->lock);
+    bp = align_block(ar,alignment,adjust_size(size));
+    pthread_mutex_unlock(&ar->lock);
+    if (bp == NULL && ar != &main_arena)// the region of the arena is full
+    {
+        ar = &main_arena;
+        LOCK(&ar->lock);
+        bp = align_block(ar,alignment,adjust_size(size));
+        pthread_mutex_unlock(&ar->lock);
+    }
+    return bp;
+}
+
+/*
+ * mm_posix_memalign - posix_memalign on top of mm_memalign,
+ * return EINVAL when alignment is not a power of 2 multiple of sizeof(void *), ENOMEM when no memory is left
+ */
+int mm_posix_memalign(void **memptr,size_t alignment,size_t size)
+{
+    void *bp = NULL;
+    
+    if (alignment < sizeof(void *) || (alignment&(alignment-1)) != 0)
+        return EINVAL;
+    if ((bp = mm_memalign(alignment,size ? size : 1)) == NULL)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc on top of mm_memalign
+ */
+void *mm_aligned_alloc(size_t alignment,size_t size)
+{
+    return mm_memalign(alignment,size);
+}
+
+/*
+ * align_block - Allocate a block of asize whose bp is a multiple of alignment.
+ * One find_fit gets a block big enough to hold an aligned block of asize after a leading free block
+ * of at least MINSIZE; the leading part is freed again and resize_block gives the tail back
+ * the caller must hold the lock of ar
+ * call function alloc_block, free_block, resize_block
+ */
+static void *align_block(arena_t *ar,size_t alignment,size_t asize)
+{
+    char *bp = NULL, *abp = NULL;
+    size_t csize = 0;
+    
+    if ((bp = alloc_block(ar,asize+alignment+BLOCK_ROUND(MINSIZE),NULL)) == NULL)
+        return NULL;
+    
+    abp = (char *)(((size_t)bp+alignment-1)&~(alignment-1));
+    if (abp != bp)
+    {
+        while ((size_t)(abp-bp) < MINSIZE)
+            abp += alignment;
+        // cut the leading part off as an allocated block and free it, it coalesces with a free block before it
+        csize = GET_SIZE(HEAD(bp));
+        PUT_HEAD(abp,PACK(csize-(abp-bp),1));
+        PUT_HEAD(bp,PACK(abp-bp,GET_PREV_ALLOC(HEAD(bp))|1));
+        free_block(ar,bp);
+    }
+    return resize_block(ar,abp,asize);
+}
+
+/*
+ * mm_calloc - Allocate nmemb*size bytes set to 0.
+ * A new mapping is already zero, and a heap block which was known-zero only needs its first
+ * PURGE_KEEP bytes and its last word cleared, so fresh pages are not touched; any other block is memset
+ * call function mmap_alloc, mm_malloc, adjust_size, arena_get, alloc_block
+ */
+void *mm_calloc(size_t nmemb,size_t size)
+{
+    size_t n = nmemb*size;
+    void *bp = NULL;
+    arena_t *ar = NULL;
+    int zero = 0;
+    
+    if (size != 0 && n/size != nmemb)// nmemb*size overflows
+        return NULL;
+    if (n >= __atomic_load_n(&mmap_threshold,__ATOMIC_RELAXED) && (bp = mmap_alloc(n)) != NULL)
+        return bp;
+    
+    if (n > SLAB_MAX && n <= MAXSIZE-DSIZE)
+    {
+        ar = arena_get();
+        LOCK(&ar->lock);
+        bp = alloc_block(ar,adjust_size(n),&zero);
+        pthread_mutex_unlock(&ar->lock);
+    }
+    if (bp == NULL && (bp = mm_malloc(n)) == NULL)
+        return NULL;
+    
+    if (zero)
+    {
+        memset(bp,0,PURGE_KEEP);
+        PUT(FOOT(bp),0);// the footer of the free block may be in the payload
+    }
+    else
+        memset(bp,0,n);
+    return bp;
+}
+
+/*
+ * adjust_size - Adjust the input size to the size of the whole block
+ */
+static size_t adjust_size(size_t size)
+{
+	// Add the head block only, the footer is not needed while the block is allocated
+    return BLOCK_ROUND(MAX(ALIGN(size+WSIZE),MINSIZE));
+}
+
+/*
+ * alloc_block - Allocate a block of asize from the quick list of asize or the free_tree of ar,
+ * coalesce the quick lists when find_fit misses and extend the heap if there is still no fit,
+ * set *zero when zero is not NULL and the block is known-zero
+ * the caller must hold the lock of ar
+ * call function find_fit, quick_flush, place and extend_heap
+ */
+static void *alloc_block(arena_t *ar,size_t asize,int *zero)
+{
+    size_t extendsize = 0;  
+    void *bp = 0;
+    int z = 0;
+    int idx = 0;
+    
+    remote_drain(ar);
+    
+	//checkpoint
+	CHECK_HEAP(ar);
+	
+    // a block of this very size freed lately is still allocated as it was, take it back at once
+    if (asize <= QUICK_MAX && (bp = ar->quick[idx = QUICK_INDEX(asize)]) != NULL)
+    {
+        ar->quick[idx] = *(void **)bp;
+        ar->quick_count[idx]--;
+        ar->quick_bytes -= asize;
+        if (zero != NULL)
+            *zero = 0;
+        return bp;
+    }
+    
+    if ((bp = find_fit(ar,asize)) == NULL && ar->quick_bytes != 0)
+    {
+        quick_flush(ar);
+        bp = find_fit(ar,asize);
+    }
+  
+    
+    if (bp != NULL)  
+    {  
+        z = place(ar,bp,asize);  
+		//checkpoint
+		TRACE("find fitted block, malloc successfully\n");
+		CHECK_BLOCK(bp);
+		
+    }  
+    else  
+    {  
+        extendsize = MAX(asize , CHUNKSIZE); 
+        // the new free block holds asize, even when find_fit would round asize past its list
+        if ((bp = extend_heap(ar,extendsize)) == NULL){  
+			return NULL;
+		}
+        z = place(ar,bp,asize);  
+		
+        //checkpoint
+		TRACE(" after extend head, malloc successfully\n");
+		CHECK_BLOCK(bp);
+    }
+    if (zero != NULL)
+        *zero = z;
+    return bp;
+}  
+
+/*
+ * slab_class - Get the slab class of a size no bigger than SLAB_MAX
+ */
+static int slab_class(size_t size)
+{
+    int msb = 0;
+    
+    if (size <= 128)
+        return (size <= 16) ? 0 : (int)((size-1)>>4);
+    // 4 classes per power of 2 above 128
+    msb = FLS(size-1);
+    return 8+((msb-7)<<2)+(int)((size-1)>>(msb-2))-4;
+}
+
+/*
+ * slab_alloc - Take an object of class cls from a partial slab,
+ * start a new slab when the class has none.
+ * return NULL when the slab region is used up
+ * the caller must hold the lock of ar, a new slab is taken under slab_lock
+ */
+static void *slab_alloc(arena_t *ar,int cls)
+{
+    slab_t *slab = ar->slab_partial[cls];
+    void *bp = NULL;
+    char *obj = NULL;
+    
+    if (slab == NULL)
+    {
+        LOCK(&slab_lock);
+        if (slab_empty != NULL)
+        {
+            slab = slab_empty;
+            slab_empty = slab->next;
+        }
+        else if (slab_hi != NULL && slab_hi < slab_end)
+        {
+            slab = (slab_t *)slab_hi;
+            slab_hi += SLAB_SIZE;
+        }
+        pthread_mutex_unlock(&slab_lock);
+        if (slab == NULL)
+            return NULL;
+        
+        // thread every object of the new slab into its free list, lowest address first
+        slab->arena = ar;
+        slab->cls = cls;
+        slab->used = 0;
+        slab->free = NULL;
+        obj = (char *)slab+SLAB_HEAD+(SLAB_SIZE-SLAB_HEAD)/slab_size[cls]*slab_size[cls];
+        while ((obj -= slab_size[cls]) >= (char *)slab+SLAB_HEAD)
+        {
+            *(void **)obj = slab->free;
+            slab->free = obj;
+        }
+        slab->prev = NULL;
+        slab->next = NULL;
+        ar->slab_partial[cls] = slab;
+    }
+    
+    bp = slab->free;
+    slab->free = *(void **)bp;
+    slab->used++;
+    ar->slab_used += slab_size[cls];
+    if (slab->free == NULL)// the slab is full, take it off the partial list
+    {
+        ar->slab_partial[cls] = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = NULL;
+    }
+    return bp;
+}
+
+/*
+ * slab_free - Give the object back to its slab,
+ * a slab with no object left goes to the empty list unless it is the last partial slab of its class
+ * the caller must hold the lock of the arena of the slab
+ */
+static void slab_free(void *bp)
+{
+    slab_t *slab = SLAB_OF(bp);
+    arena_t *ar = slab->arena;
+    int cls = slab->cls;
+    
+    if (slab->free == NULL)// the slab was full, put it back to the partial list
+    {
+        slab->prev = NULL;
+        slab->next = ar->slab_partial[cls];
+        if (slab->next != NULL)
+            slab->next->prev = slab;
+        ar->slab_partial[cls] = slab;
+    }
+    *(void **)bp = slab->free;
+    slab->free = bp;
+    slab->used--;
+    ar->slab_used -= slab_size[cls];
+    
+    if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL))
+    {
+        if (slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            ar->slab_partial[cls] = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = slab->prev;
+        LOCK(&slab_lock);
+        slab->next = slab_empty;
+        slab_empty = slab;
+        pthread_mutex_unlock(&slab_lock);
+    }
+}
+
+/*
+ * mmap_alloc - Give the block a mapping of its own, the header only marks it as mapped
+ * return NULL when the mapping fails
+ */
+static void *mmap_alloc(size_t size)
+{
+    size_t len = (size+MMAP_HEAD+page_size-1)&~(page_size-1);
+    char *start = NULL;
+    void *bp = NULL;
+    
+    if (len < size)// size is so big that len wraps around
+        return NULL;
+    start = mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (start == MAP_FAILED)
+        return NULL;
+    
+    bp = start+MMAP_HEAD;
+    MMAP_LEN(bp) = len;
+    PUT_HEAD(bp,PACK(0,MMAPPED|1));
+    __atomic_fetch_add(&mmap_bytes,len,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&mmap_blocks,1,__ATOMIC_RELAXED);
+    return bp;
+}
+
+/*
+ * mmap_free - Give the mapping of the block back to the OS.
+ * Like glibc, a freed mapping bigger than the threshold raises the threshold to its size,
+ * so buffers of that size which are freed and allocated again are kept in the heap from now on
+ */
+static void mmap_free(void *bp)
+{
+    size_t len = MMAP_LEN(bp);
+    
+    if (!mmap_threshold_fixed && len-MMAP_HEAD > __atomic_load_n(&mmap_threshold,__ATOMIC_RELAXED)
+        && len-MMAP_HEAD <= MMAP_THRESHOLD_MAX)
+        __atomic_store_n(&mmap_threshold,len-MMAP_HEAD,__ATOMIC_RELAXED);
+    munmap((char *)bp-MMAP_HEAD,len);
+    __atomic_fetch_sub(&mmap_bytes,len,__ATOMIC_RELAXED);
+    __atomic_fetch_sub(&mmap_blocks,1,__ATOMIC_RELAXED);
+}
+
+/*
+ * mremap_block - Resize the mapping of the block with mremap, which moves page table entries,
+ * so the cost does not depend on the size of the block.
+ * return NULL when the system has no mremap or it fails
+ */
+static void *mremap_block(void *bp,size_t size)
+{
+#ifdef MREMAP_MAYMOVE
+    size_t len = (size+MMAP_HEAD+page_size-1)&~(page_size-1);
+    size_t old = MMAP_LEN(bp);
+    char *start = NULL;
+    
+    if (len < size)
+        return NULL;
+    start = mremap((char *)bp-MMAP_HEAD,old,len,MREMAP_MAYMOVE);
+    if (start == MAP_FAILED)
+        return NULL;
+    __atomic_fetch_add(&mmap_bytes,len-old,__ATOMIC_RELAXED);// wraps around when it shrinks
+    
+    // the header stays in the first page
+    bp = start+MMAP_HEAD;
+    MMAP_LEN(bp) = len;
+    return bp;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * mm_set_mmap_threshold - Serve requests of at least size bytes with their own mapping,
+ * the threshold is not adjusted automatically any more
+ */
+void mm_set_mmap_threshold(size_t size)
+{
+    mmap_threshold_fixed = 1;
+    __atomic_store_n(&mmap_threshold,size,__ATOMIC_RELAXED);
+}
+
+/*
+ * mm_set_purge_decay - Give the pages of a free block back to the OS after it stayed free ms milliseconds,
+ * 0 purges as soon as possible and -1 never
+ */
+void mm_set_purge_decay(long ms)
+{
+    __atomic_store_n(&purge_decay,ms,__ATOMIC_RELAXED);
+}
+
+/*
+ * purge_clock - Milliseconds since mm_init, never PURGED
+ */
+static unsigned int purge_clock()
+{
+    struct timespec ts;
+    unsigned int ms = 0;
+    
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    ms = (unsigned int)((ts.tv_sec-purge_epoch.tv_sec)*1000+(ts.tv_nsec-purge_epoch.tv_nsec)/1000000);
+    return (ms == PURGED) ? ms-1 : ms;
+}
+
+/*
+ * purge_tick - Run a purge pass if a quarter of the decay time passed since the last one.
+ * A pass which gives pages back halves the extend_heap step, the heap has more than it needs
+ * the caller must hold the lock of ar
+ */
+static void purge_tick(arena_t *ar)
+{
+    unsigned int now = 0;
+    long decay = __atomic_load_n(&purge_decay,__ATOMIC_RELAXED);
+    
+    ar->purge_ticks = 0;
+    if (decay < 0)
+        return;
+    now = purge_clock();
+    if (now-ar->purge_last < (unsigned long)decay/4)
+        return;
+    ar->purge_last = now;
+    if (purge_index(ar,now) != 0)
+        ar->grow = MAX(ar->grow>>1,CHUNKSIZE);
+}
+
+/*
+ * purge_block - Give back the whole pages (huge pages under MM_THP) between the stamp and the footer
+ * of a free block which is free for longer than purge_decay, its header, links and footer are kept
+ * return the bytes given back
+ */
+static size_t purge_block(void *bp,unsigned int now)
+{
+    size_t start = 0, end = 0;
+    unsigned int stamp = 0;
+    
+    if (GET_SIZE(HEAD(bp)) < (commit_size<<1))
+        return 0;
+    stamp = GET(STAMP(bp));
+    if (stamp == PURGED || now-stamp < (unsigned long)__atomic_load_n(&purge_decay,__ATOMIC_RELAXED))
+        return 0;
+    
+    start = ((size_t)bp+PURGE_KEEP+commit_size-1)&~(commit_size-1);
+    end = (size_t)FOOT(bp)&~(commit_size-1);
+    PUT(STAMP(bp),PURGED);
+    if (start >= end)
+        return 0;
+    madvise((void *)start,end-start,MADV_DONTNEED);
+    return end-start;
+}
+
+#ifndef MM_TLSF
+/*
+ * purge_index - Purge the free blocks of at least twice commit_size, from the smallest one up the tree
+ * return the bytes given back
+ */
+static size_t purge_index(arena_t *ar,unsigned int now)
+{
+    void *node = find_fit(ar,commit_size<<1);
+    void *bros = NULL;
+    size_t purged = 0;
+    
+    for ( ; node != NULL; node = tree_next(ar,node))
+        for (bros = node; bros != NULL; bros = GET_BROS(bros))
+            purged += purge_block(bros,now);
+    return purged;
+}
+
+/*
+ * tree_next - Get the next bigger node of free_tree, walking up by the parent links
+ */
+static void *tree_next(arena_t *ar,void *node)
+{
+    void *par = NULL;
+    
+    if (GET_RIGHT_CHILD(node) != NULL)
+    {
+        node = GET_RIGHT_CHILD(node);
+        while (GET_LEFT_CHILD(node) != NULL)
+            node = GET_LEFT_CHILD(node);
+        return node;
+    }
+    // the parent link of the root is not kept up to date, stop there
+    while (node != ar->free_tree)
+    {
+        par = GET_PART(node);
+        if (GET_SIZE(HEAD(node)) < GET_SIZE(HEAD(par)))// node is a left child
+            return par;
+        node = par;
+    }
+    return NULL;
+}
+#else
+/*
+ * purge_index - Purge the free blocks of at least twice commit_size, list by list
+ * return the bytes given back
+ */
+static size_t purge_index(arena_t *ar,unsigned int now)
+{
+    int fl = 0, sl = 0;
+    void *bp = NULL;
+    size_t purged = 0;
+    
+    tlsf_mapping(commit_size<<1,&fl,&sl);
+    for ( ; fl < FL_COUNT; fl++, sl = 0)
+    {
+        if (!(ar->fl_bitmap&(1U<<fl)))
+            continue;
+        for ( ; sl < SL_COUNT; sl++)
+            for (bp = ar->free_lists[fl][sl]; bp != NULL; bp = GET_NEXT_FREE(bp))
+                purged += purge_block(bp,now);
+    }
+    return purged;
+}
+#endif
+
+/*
+ * mm_stats - Fill st with the counters and a walk of the free index of every arena,
+ * taking the lock of one arena at a time. The counters are plain increments under locks
+ * which are held anyway, or relaxed atomics, so they are always on
+ * call function remote_drain, stats_index
+ */
+void mm_stats(mm_stats_t *st)
+{
+    int i = 0, k = 0;
+    arena_t *ar = NULL;
     
-}  
+    memset(st,0,sizeof(*st));
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 0; i < MAX_ARENAS; i++)
+    {
+        if ((ar = arenas[i]) == NULL || ar->heap_listp == NULL)
+            continue;
+        pthread_mutex_lock(&ar->lock);
+        remote_drain(ar);
+        st->heap_size += ar->heap_hi-ar->heap_lo;
+        st->slab_in_use += ar->slab_used;
+        st->extend_heap_count += ar->extend_count;
+        st->quick_bytes += ar->quick_bytes;
+        for (k = 0; k < 4; k++)
+            st->coalesce_count[k] += ar->coalesce_count[k];
+        stats_index(ar,st);
+        pthread_mutex_unlock(&ar->lock);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    
+    pthread_mutex_lock(&slab_lock);
+    st->slab_size = slab_hi-slab_lo;
+    pthread_mutex_unlock(&slab_lock);
+    st->mmap_size = __atomic_load_n(&mmap_bytes,__ATOMIC_RELAXED);
+    st->mmap_count = __atomic_load_n(&mmap_blocks,__ATOMIC_RELAXED);
+    st->realloc_copy_bytes = __atomic_load_n(&realloc_copied,__ATOMIC_RELAXED);
+    st->lock_contended = __atomic_load_n(&lock_contended,__ATOMIC_RELAXED);
+    
+    st->heap_in_use = st->heap_size-st->free_bytes-st->quick_bytes;
+    st->in_use = st->heap_in_use+st->slab_in_use+st->mmap_size;
+    st->fragmentation = (st->free_bytes == 0) ? 0.0 : 1.0-(double)st->largest_free/st->free_bytes;
+}
 
+/*
+ * stats_free - Count one free block of size in st
+ */
+static void stats_free(mm_stats_t *st,size_t size)
+{
+    st->free_bytes += size;
+    st->free_blocks++;
+    st->free_by_class[FLS(size)] += size;
+    st->largest_free = MAX(st->largest_free,size);
+}
 
-/* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- * Always allocate a block whose size is a multiple of the alignment.
- * Allocate the size after adjusted according to input size 
- * call function find_fit , place and extend_heap
+#ifndef MM_TLSF
+/*
+ * stats_index - Count the free blocks of ar node by node, from the smallest one up the tree
  */
-void *mm_malloc(size_t size)  
+static void stats_index(arena_t *ar,mm_stats_t *st)
 {
-    //checkpoint
-	if(showflag ==1){
-		printf("begin to malloc\n");
-	}
-    size_t asize = 0;   
-    size_t extendsize = 0;  
-    void *bp = 0;
+    void *node = find_fit(ar,0);
+    void *bros = NULL;
     
+    for ( ; node != NULL; node = tree_next(ar,node))
+    {
+        st->tree_nodes++;
+        for (bros = node; bros != NULL; bros = GET_BROS(bros))
+            stats_free(st,GET_SIZE(HEAD(bros)));
+    }
+}
+#else
+/*
+ * stats_index - Count the free blocks of ar list by list
+ */
+static void stats_index(arena_t *ar,mm_stats_t *st)
+{
+    int fl = 0, sl = 0;
+    void *bp = NULL;
     
-	//checkpoint
-	if(checkflag == 1)
-		mm_check();
-	
-    //ignore spurious requests
-    if (size <= 0)
+    for (fl = 0; fl < FL_COUNT; fl++)
+        for (sl = 0; sl < SL_COUNT; sl++)
+        {
+            if ((bp = ar->free_lists[fl][sl]) != NULL)
+                st->tree_nodes++;
+            for ( ; bp != NULL; bp = GET_NEXT_FREE(bp))
+                stats_free(st,GET_SIZE(HEAD(bp)));
+        }
+}
+#endif
+
+/*
+ * tc_refill - Move up to TC_BATCH objects of class idx from the slabs of this thread's arena
+ * to this thread's cache with one lock
+ * return 0 when no object can be allocated
+ */
+static int tc_refill(int idx)
+{
+    void *bp = NULL;
+    int n = 0;
+    int batch = (tcache.state < 0) ? 1 : TC_BATCH;// an exiting thread only takes what it uses
+    arena_t *ar = NULL;
+    
+    tc_attach();
+    ar = arena_get();
+    LOCK(&ar->lock);
+    for (n = 0; n < batch && (bp = slab_alloc(ar,idx)) != NULL; n++)
     {
-        printf("Invalid request.");
-        return NULL;
+        *(void **)bp = tcache.head[idx];
+        tcache.head[idx] = bp;
+        tcache.count[idx]++;
     }
-	// Adjust the input size to a nearest larger number which is power of 2
-    if (size <= MINSIZE-8)  
-        asize = MINSIZE-8;  
-    else if (size <= 32) 
-		asize = 32;
-	else if (size <= 64)
-		asize = 64;
-	else if (size <= 128)
-		asize = 128;
-	else if (size <= 256)
-		asize = 256;
-	else if (size <= 512)
-		asize = 512;
-    else     
-	{	
-        asize = ALIGN(size);  
-    } 
-	
-	// Add the foot and head block
-	asize = asize + 8;
-    bp = find_fit(asize);  
-  
+    pthread_mutex_unlock(&ar->lock);
+    return n;
+}
+
+/*
+ * tc_flush - Give n cached objects of class idx back to their slabs,
+ * the lock of an arena is kept over the run of objects from the same arena
+ */
+static void tc_flush(int idx,unsigned int n)
+{
+    void *bp = NULL;
+    arena_t *ar = NULL, *locked = NULL;
     
-    if (bp != NULL)  
-    {  
-        place(bp,asize);  
-		//checkpoint
-		if(showflag == 1){
-			printf("find fitted block, malloc successfully\n");
-		}
-		if(checkflag == 1){
-			checkblock(bp);
-		}
-		
-    }  
-    else  
-    {  
-        extendsize = MAX(asize , CHUNKSIZE); 
-        if(bp = extend_heap(extendsize) == NULL){  
-			return NULL;
-		}
-        if ((bp = find_fit(asize)) == NULL){  
-            return NULL;  
-		}
-        place(bp,asize);  
-		
-        //checkpoint
-		if(showflag == 1){
-			printf(" after extend head, malloc successfully\n");
-		}
-		if(checkflag == 1){
-			checkblock(bp);
-		}
+    while (n-- > 0 && (bp = tcache.head[idx]) != NULL)
+    {
+        tcache.head[idx] = *(void **)bp;
+        tcache.count[idx]--;
+        // a slab with an allocated object stays with its arena
+        ar = SLAB_OF(bp)->arena;
+        if (ar != locked)
+        {
+            if (locked != NULL)
+                pthread_mutex_unlock(&locked->lock);
+            LOCK(&ar->lock);
+            locked = ar;
+        }
+        slab_free(bp);
     }
-    return bp;
+    if (locked != NULL)
+        pthread_mutex_unlock(&locked->lock);
+}
+
+/*
+ * tc_push - Put a free slab object in the cache list idx of this thread,
+ * flush TC_BATCH objects of the list first when it is full
+ */
+static void tc_push(int idx,void *bp)
+{
+    tc_attach();
+    if (tcache.count[idx] >= TC_DEPTH)
+        tc_flush(idx,TC_BATCH);
     
+    *(void **)bp = tcache.head[idx];
+    tcache.head[idx] = bp;
+    tcache.count[idx]++;
+}
+
+/*
+ * tc_destroy - Called when a thread exits, flush all its cached blocks and the remote queue of its arena,
+ * which may have no thread left to free it
+ */
+static void tc_destroy(void *arg)
+{
+    int i = 0;
     
-}  
+    for (i = 0; i < SLAB_CLASSES; i++)
+        tc_flush(i,TC_DEPTH);
+    if (tcache.arena != NULL)
+    {
+        LOCK(&tcache.arena->lock);
+        if (tcache.arena->heap_listp != NULL)// not dropped by mm_init since
+            remote_drain(tcache.arena);
+        pthread_mutex_unlock(&tcache.arena->lock);
+    }
+    // frees after this point go straight to the slabs
+    tcache.state = -1;
+}
 
+static void tc_make_key()
+{
+    pthread_key_create(&tc_key,tc_destroy);
+}
+
+/*
+ * tc_attach - Register this thread's cache the first time it is used, so it is flushed when the thread exits
+ */
+static void tc_attach()
+{
+    if (tcache.state == 0)
+    {
+        pthread_once(&tc_once,tc_make_key);
+        pthread_setspecific(tc_key,&tcache);
+        tcache.state = 1;
+    }
+}
 
+#ifndef MM_TLSF
 /*
  *  function find_fit
  *  use best fit search,use while to get it
  */
-static void* find_fit(size_t asize)
+static void* find_fit(arena_t *ar,size_t asize)
 {
-    if(showflag == 1){
-		printf("begin to find fit\n");
-	}
-	void *free_root = free_tree;
+    TRACE("begin to find fit\n");
+	void *free_root = ar->free_tree;
     void *free_fit = NULL;
     
-    if (free_tree == NULL)
+    if (ar->free_tree == NULL)
         return free_fit;
 
     for( ;free_root != NULL; )
@@ -486,95 +2068,183 @@ static void* find_fit(size_t asize)
     }
     
     //checkpoint
-	if(showflag == 1){
-		printf("find fit successfully\n");
-	}
-	if(checkflag == 1){
-		checkblock(free_fit);
-	}
+	TRACE("find fit successfully\n");
+	CHECK_BLOCK(free_fit);
     
     return free_fit;
 }  
+#endif
 
 
 /*
  * function place
  * get the address bp whose size of it is asize
+ * return 1 when the block was known-zero, then the rest split off is known-zero too
  */
-static void place(void *bp,size_t asize)
+static int place(arena_t *ar,void *bp,size_t asize)
 {
     //checkpoint
-    if(showflag ==1){
-		printf("begin to place\n");
-	}
-    void *coalesced_bp = NULL;
-    
+    TRACE("begin to place\n");
 	size_t csize = GET_SIZE(HEAD(bp));
+    unsigned int stamp = 0;
+    unsigned int zero = IS_ZERO(bp);
     
-    delete_node(bp);
+    delete_node(ar,bp);
 
     if ((csize-asize)>=24)				//while the block can be divided into two illegal blocks
     {
-        PUT_HEAD(bp,PACK(asize,1));
-        PUT_FOOT(bp,PACK(asize,1));
+        if (csize >= (page_size<<1))
+            stamp = GET(STAMP(bp));
+        PUT_HEAD(bp,PACK(asize,PREV_ALLOC|1));
         bp=NEXT_BLKP(bp);
-        PUT_HEAD(bp,PACK(csize-asize,0));
+        PUT_HEAD(bp,PACK(csize-asize,PREV_ALLOC|zero));
         PUT_FOOT(bp,PACK(csize-asize,0));
 
-		add_node(bp);
+		add_node(ar,bp);
+        // the pages of the rest are as dirty or as purged as they were
+        if (stamp != 0 && csize-asize >= (page_size<<1))
+            PUT(STAMP(bp),stamp);
     }
     else
     {
-        PUT_HEAD(bp,PACK(csize,1));
-        PUT_FOOT(bp,PACK(csize,1));
+        PUT_HEAD(bp,PACK(csize,PREV_ALLOC|1));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
     }
     
     
     
     //checkpoint
-	if(showflag == 1){
-		printf("place successfully\n");
-	}
+	TRACE("place successfully\n");
+    return zero != 0;
 }
 
 
  
 /*
-* mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+* mm_realloc - Resize the block in place when possible,
+* otherwise implemented simply in terms of mm_malloc and mm_free
+* call function resize_block
 */
 void *mm_realloc(void *ptr,size_t size)  
 {  
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
+    arena_t *ar = NULL;
+    
+    if (oldptr == NULL)
+        return mm_malloc(size);
+    if (size == 0)
+    {
+        mm_free(oldptr);
+        return NULL;
+    }
+    if (IS_SLAB(oldptr))
+    {
+        // keep the object while at least half of it is used
+        copySize = slab_size[SLAB_OF(oldptr)->cls];
+        if (size <= copySize && size >= (copySize>>1))
+            return oldptr;
+    }
+    else if (IS_MMAPPED(oldptr))
+    {
+        copySize = MMAP_LEN(oldptr)-MMAP_HEAD;
+        if (size <= copySize && size >= (copySize>>1))
+            return oldptr;
+        // the new size still deserves a mapping, let the kernel move the pages instead of copying the bytes
+        if (size >= __atomic_load_n(&mmap_threshold,__ATOMIC_RELAXED) && (newptr = mremap_block(oldptr,size)) != NULL)
+            return newptr;
+    }
+    else
+    {
+        // the new size fits in the block and leaves no tail to split off: nothing to do, not even locking
+        copySize = GET_SIZE(HEAD(oldptr));
+        if (size <= copySize-WSIZE && adjust_size(size)+MINSIZE > copySize)
+            return oldptr;
+        if (size <= MAXSIZE-DSIZE)
+        {
+            ar = arena_of(oldptr);
+            LOCK(&ar->lock);
+            newptr = resize_block(ar,oldptr,adjust_size(size));
+            pthread_mutex_unlock(&ar->lock);
+            if (newptr != NULL)
+                return newptr;
+        }
+        copySize = GET_SIZE(HEAD(oldptr))-WSIZE;
+    }
     
     newptr = mm_malloc(size);
     if (newptr == NULL)
       return NULL;
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
     if (size < copySize)
       copySize = size;
     memcpy(newptr, oldptr, copySize);
+    __atomic_fetch_add(&realloc_copied,copySize,__ATOMIC_RELAXED);
     mm_free(oldptr);
     return newptr;
 }  
+
+/*
+ * resize_block - Make the allocated block bp asize big without moving it
+ * grow it by absorbing the next block if it is free, extend the heap first when bp is the last block,
+ * and split the unused tail into a free block.
+ * return NULL when bp can not grow in place
+ * the caller must hold the lock of ar
+ */
+static void *resize_block(arena_t *ar,void *bp,size_t asize)
+{
+    size_t csize = GET_SIZE(HEAD(bp));
+    size_t avail = 0;
+    void *next_block = NEXT_BLKP(bp);
+    void *rest = NULL;
+    
+    if (asize > csize)
+    {
+        // bp is the last block, or only a free block lies between it and the epilogue
+        if (GET_SIZE(HEAD(next_block)) == 0 ||
+            (!GET_ALLOC(HEAD(next_block)) && GET_SIZE(HEAD(NEXT_BLKP(next_block))) == 0))
+        {
+            avail = csize+(GET_ALLOC(HEAD(next_block)) ? 0 : GET_SIZE(HEAD(next_block)));
+            // the new space is coalesced into next_block, or starts at the old epilogue which is next_block
+            if (avail < asize && extend_heap(ar,MAX(asize-avail,CHUNKSIZE)) == NULL)
+                return NULL;
+        }
+        if (GET_ALLOC(HEAD(next_block)) || csize+GET_SIZE(HEAD(next_block)) < asize)
+            return NULL;
+        
+        delete_node(ar,next_block);
+        csize += GET_SIZE(HEAD(next_block));
+        PUT_HEAD(bp,PACK(csize,GET_PREV_ALLOC(HEAD(bp))|1));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+    }
+    
+    if ((csize-asize) >= MINSIZE)// give the tail back
+    {
+        PUT_HEAD(bp,PACK(asize,GET_PREV_ALLOC(HEAD(bp))|1));
+        rest = NEXT_BLKP(bp);
+        PUT_HEAD(rest,PACK(csize-asize,PREV_ALLOC));
+        PUT_FOOT(rest,PACK(csize-asize,0));
+        CLEAR_PREV_ALLOC(NEXT_BLKP(rest));
+        add_node(ar,coalesce(ar,rest));
+    }
+    return bp;
+}
   
 
-static void add_node(void *bp)
+#ifndef MM_TLSF
+static void add_node(arena_t *ar,void *bp)
 {
     int ca = 0;
     //checkpoint
-    if(showflag == 1){
-		printf("begin to add node\n");
-	}
-	if(checkflag == 1){
-		mm_check();
-		check(bp);
-	}
+    TRACE("begin to add node\n");
+	CHECK_BLOCK(bp);
+    
+    if (GET_SIZE(HEAD(bp)) >= (page_size<<1))
+        PUT(STAMP(bp),purge_clock());
     
-    if (free_tree == 0)// if there is no free block in free-tree
+    if (ar->free_tree == 0)// if there is no free block in free-tree
     {
-        free_tree = bp;
+        ar->free_tree = bp;
         PUT_LEFT_CHILD(bp,0);
         PUT_RIGHT_CHILD(bp,0);
         PUT_PART(bp,0);
@@ -582,12 +2252,9 @@ static void add_node(void *bp)
         return;
     }
     
-    void *my_tr = free_tree;
-    void *par_my_tr = 0;
+    void *my_tr = ar->free_tree;
 	
-	if(checkflag == 1){
-		checkblock(free_tree);
-	}
+	CHECK_BLOCK(ar->free_tree);
     
     while(1)
     {
@@ -607,9 +2274,9 @@ static void add_node(void *bp)
         ca = 1;
     else if (GET_SIZE(HEAD(bp)) > GET_SIZE(HEAD(my_tr)))
         ca = 2;
-    else if ((GET_SIZE(HEAD(bp)) == GET_SIZE(HEAD(my_tr)))&&(my_tr != free_tree))
+    else if ((GET_SIZE(HEAD(bp)) == GET_SIZE(HEAD(my_tr)))&&(my_tr != ar->free_tree))
         ca = 3;
-    else if ((GET_SIZE(HEAD(bp)) == GET_SIZE(HEAD(my_tr)))&&(my_tr == free_tree))
+    else if ((GET_SIZE(HEAD(bp)) == GET_SIZE(HEAD(my_tr)))&&(my_tr == ar->free_tree))
         ca = 4;
     switch (ca) {
         case 1:
@@ -640,11 +2307,11 @@ static void add_node(void *bp)
                 PUT_PART(GET_RIGHT_CHILD(my_tr),bp);
             PUT_PART(bp,GET_PART(my_tr));
             PUT_BROS(bp,my_tr);
-            PUT_RIGHT_CHILD(my_tr,-1);
+            PUT_LIST_MARK(my_tr);
             PUT_LEFT_CHILD(my_tr,bp);
             break;
         case 4://set to root
-            free_tree = bp;
+            ar->free_tree = bp;
             PUT_LEFT_CHILD(bp,GET_LEFT_CHILD(my_tr));
             PUT_RIGHT_CHILD(bp,GET_RIGHT_CHILD(my_tr));
             if (GET_LEFT_CHILD(my_tr) != 0)
@@ -655,51 +2322,46 @@ static void add_node(void *bp)
             PUT_BROS(bp,my_tr);
             
             PUT_LEFT_CHILD(my_tr,bp);
-            PUT_RIGHT_CHILD(my_tr,-1);
+            PUT_LIST_MARK(my_tr);
             break;
             
     }
 	return;
 }
 
-static void delete_node(void *bp)  
+static void delete_node(arena_t *ar,void *bp)  
 {  
     //checkpoint
-    if(showflag ==1){
-		printf("begin to delete!\n");
-	}
-	if(checkflag == 1){
-		mm_check();
-		checkblock(bp);
-	}
+    TRACE("begin to delete!\n");
+	CHECK_BLOCK(bp);
 	
 	
-	if (bp == free_tree)////////////////// bp is root////////////////////////////////////////////////////////////////////////////////////////
+	if (bp == ar->free_tree)////////////////// bp is root////////////////////////////////////////////////////////////////////////////////////////
     {  
         if (GET_BROS(bp) != 0)    //if there are more than one free block in this level
         {  
-            free_tree = GET_BROS(bp);  // set the second one to be the first one 
-            PUT_LEFT_CHILD(free_tree,GET_LEFT_CHILD(bp));  
-            PUT_RIGHT_CHILD(free_tree,GET_RIGHT_CHILD(bp));  
+            ar->free_tree = GET_BROS(bp);  // set the second one to be the first one 
+            PUT_LEFT_CHILD(ar->free_tree,GET_LEFT_CHILD(bp));  
+            PUT_RIGHT_CHILD(ar->free_tree,GET_RIGHT_CHILD(bp));  
             if (GET_RIGHT_CHILD(bp) != 0)  
-                PUT_PART(GET_RIGHT_CHILD(bp),free_tree);  
+                PUT_PART(GET_RIGHT_CHILD(bp),ar->free_tree);  
             if (GET_LEFT_CHILD(bp) != 0)  
-                PUT_PART(GET_LEFT_CHILD(bp),free_tree);  
+                PUT_PART(GET_LEFT_CHILD(bp),ar->free_tree);  
             return;  
         }  
         else// there is only one free block in this level
         {  
             if (GET_LEFT_CHILD(bp) == 0)        // no left child  
-                free_tree = GET_RIGHT_CHILD(bp);  
+                ar->free_tree = GET_RIGHT_CHILD(bp);  
             else if (GET_RIGHT_CHILD(bp) == 0)  // no right child   
-                free_tree = GET_LEFT_CHILD(bp);  
+                ar->free_tree = GET_LEFT_CHILD(bp);  
             else                                // have two children
             {  
                 void *my_tr = GET_RIGHT_CHILD(bp);  
                 while (GET_LEFT_CHILD(my_tr) != 0)  
                     my_tr = GET_LEFT_CHILD(my_tr);  
 					
-                free_tree = my_tr; 
+                ar->free_tree = my_tr; 
 				
                 if (GET_LEFT_CHILD(bp) != 0)  
                     PUT_PART(GET_LEFT_CHILD(bp),my_tr); 
@@ -719,13 +2381,13 @@ static void delete_node(void *bp)
     }  
     else//////////////////////////////////if bp is not root///////////////////////////////////////////////////////////////////////////
     {  
-        if (GET_RIGHT_CHILD(bp) == -1)///////////////////////////////////////////// bp is not the first one in this level
+        if (IS_LIST_NODE(bp))///////////////////////////////////////////// bp is not the first one in this level
         {// not the first block in the node
             if (GET_BROS(bp) != 0)
                 PUT_LEFT_CHILD(GET_BROS(bp),GET_LEFT_CHILD(bp));
             PUT_BROS(GET_LEFT_CHILD(bp),GET_BROS(bp));
         }
-        else if (GET_RIGHT_CHILD(bp) != -1 && GET_BROS(bp) != 0)//////// the first one but not the only one in this level
+        else if (!IS_LIST_NODE(bp) && GET_BROS(bp) != 0)//////// the first one but not the only one in this level
         {// the first block in the node
             
             if (GET_SIZE(HEAD(bp)) > GET_SIZE(HEAD(GET_PART(bp))))
@@ -742,7 +2404,7 @@ static void delete_node(void *bp)
                 PUT_PART(GET_RIGHT_CHILD(bp),GET_BROS(bp));
             PUT_PART(GET_BROS(bp),GET_PART(bp));
         }
-        else if (GET_RIGHT_CHILD(bp) != -1 && GET_BROS(bp) == 0)///////////bp is the first and the only one in this level
+        else if (!IS_LIST_NODE(bp) && GET_BROS(bp) == 0)///////////bp is the first and the only one in this level
         {  
             if  (GET_RIGHT_CHILD(bp) == 0)      //have no right child
             {// it has no right child   
@@ -786,35 +2448,296 @@ static void delete_node(void *bp)
         }  
     }  
 }  
+#endif
+
+
+#ifdef MM_TLSF
+/*
+ * tlsf_mapping - Get the first-level and second-level list of a block size
+ * sizes below 1<<FL_SHIFT are kept in exact lists of 8 bytes step in first level 0,
+ * each bigger power of 2 range is split into SL_COUNT lists of the same width
+ */
+static void tlsf_mapping(size_t size,int *fl,int *sl)
+{
+    int msb = 0;
+    
+    if (size < (1<<FL_SHIFT))
+    {
+        *fl = 0;
+        *sl = size>>3;
+    }
+    else
+    {
+        msb = FLS(size);
+        *fl = msb-FL_SHIFT+1;
+        *sl = (size>>(msb-SL_LOG))^SL_COUNT;
+    }
+}
+
+/*
+ *  function find_fit
+ *  round asize up to the next list so that every block in the list found is big enough,
+ *  then use the bitmaps to get the first non-empty list, no loop over blocks.
+ *  When no such list exists, return NULL even if the list of asize holds a block big enough:
+ *  extend_heap serves the miss, which keeps the lookup constant time
+ */
+static void* find_fit(arena_t *ar,size_t asize)
+{
+    int fl = 0, sl = 0;
+    unsigned int sl_map = 0, fl_map = 0;
+    size_t rsize = asize;
+    void *bp = NULL;
+    
+    if (rsize >= (1<<FL_SHIFT))
+        rsize += ((size_t)1<<(FLS(rsize)-SL_LOG))-1;
+    tlsf_mapping(rsize,&fl,&sl);
+    
+    if (fl < FL_COUNT)
+    {
+        sl_map = ar->sl_bitmap[fl]&(~0U<<sl);
+        if (sl_map == 0 && fl+1 < FL_COUNT && (fl_map = ar->fl_bitmap&(~0U<<(fl+1))) != 0)
+        {
+            // no list big enough in this range, go to the next non-empty range
+            fl = __builtin_ctz(fl_map);
+            sl_map = ar->sl_bitmap[fl];
+        }
+        if (sl_map != 0)
+        {
+            bp = ar->free_lists[fl][__builtin_ctz(sl_map)];
+            //checkpoint
+            CHECK_BLOCK(bp);
+            return bp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * add_node - Push the free block at the head of its list and mark the list non-empty
+ */
+static void add_node(arena_t *ar,void *bp)
+{
+    int fl = 0, sl = 0;
+    void *head = NULL;
+    
+    if (GET_SIZE(HEAD(bp)) >= (page_size<<1))
+        PUT(STAMP(bp),purge_clock());
+    
+    tlsf_mapping(GET_SIZE(HEAD(bp)),&fl,&sl);
+    head = ar->free_lists[fl][sl];
+    
+    PUT_PREV_FREE(bp,0);
+    PUT_NEXT_FREE(bp,head);
+    if (head != NULL)
+        PUT_PREV_FREE(head,bp);
+    ar->free_lists[fl][sl] = bp;
+    
+    ar->fl_bitmap |= 1U<<fl;
+    ar->sl_bitmap[fl] |= 1U<<sl;
+}
+
+/*
+ * delete_node - Unlink the free block from its list and clear the bits of an emptied list
+ */
+static void delete_node(arena_t *ar,void *bp)
+{
+    int fl = 0, sl = 0;
+    void *prev = GET_PREV_FREE(bp);
+    void *next = GET_NEXT_FREE(bp);
+    
+    if (next != NULL)
+        PUT_PREV_FREE(next,prev);
+    if (prev != NULL)
+    {
+        PUT_NEXT_FREE(prev,next);
+        return;
+    }
+    
+    // bp is the head of its list
+    tlsf_mapping(GET_SIZE(HEAD(bp)),&fl,&sl);
+    ar->free_lists[fl][sl] = next;
+    if (next == NULL)
+    {
+        ar->sl_bitmap[fl] &= ~(1U<<sl);
+        if (ar->sl_bitmap[fl] == 0)
+            ar->fl_bitmap &= ~(1U<<fl);
+    }
+}
+#endif
   
 
 
 
-// Check one address,  check it block bp and its next block
-static void checkblock(void *bp)
+/*
+ * mm_checkheap - Check the heap of every arena,
+ * return 0 when all is fine, otherwise the MM_CHECK error code of the first violation
+ */
+int mm_checkheap()
+{
+    int i = 0, err = 0;
+    arena_t *ar = NULL;
+    
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 0; i < MAX_ARENAS && err == 0; i++)
+    {
+        if ((ar = arenas[i]) == NULL || ar->heap_listp == NULL)
+            continue;
+        pthread_mutex_lock(&ar->lock);
+        err = mm_check(ar);
+        pthread_mutex_unlock(&ar->lock);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    return err;
+}
+
+/*
+ * check_fail - Report the violation on stderr and return its error code
+ */
+static int check_fail(int err,const char *what,void *bp)
+{
+    fprintf(stderr,"mm_check: %s at %p\n",what,bp);
+    return err;
+}
+
+/*
+ * checkblock - Check the alignment and the size of bp, and the footer of a free block
+ * return 0 or the MM_CHECK error code
+ */
+static int checkblock(void *bp)
 {
-	
-    printf("HEAD[size|allocated]---FOOT[size|allocated]\n");
-    printf("%p[%d|%d] --- %p[%d|%d]\n",HEAD(bp),GET_SIZE(HEAD(bp)),GET_ALLOC(HEAD(bp))\
-           ,FOOT(bp),GET_SIZE(HEAD(bp)),GET_ALLOC(HEAD(bp)));
+    size_t size = 0;
+    
+    if (bp == NULL)
+        return 0;
+    size = GET_SIZE(HEAD(bp));
+    if (((size_t)bp&(BLOCK_ALIGN-1)) != 0)
+        return check_fail(MM_CHECK_BLOCK,"misaligned block",bp);
+    if (size == 0)// the epilogue
+        return GET_ALLOC(HEAD(bp)) ? 0 : check_fail(MM_CHECK_BLOCK,"free epilogue",bp);
+    if (size < MINSIZE)
+        return check_fail(MM_CHECK_BLOCK,"block smaller than MINSIZE",bp);
+    if (!GET_ALLOC(HEAD(bp)) && GET(FOOT(bp)) != PACK(size,0))
+        return check_fail(MM_CHECK_BLOCK,"footer does not match the header",bp);
+    return 0;
+}
+
+/*
+ * mm_check - Check the heap of ar block by block, then check that the free index holds exactly its free blocks.
+ * Stop at the first violation
+ * return 0 or the MM_CHECK error code
+ * the caller must hold the lock of ar
+ */
+static int mm_check(arena_t *ar)
+{
+    char *bp = ar->heap_listp;
+    unsigned int prev_alloc = PREV_ALLOC;
+    size_t nfree = 0, n = 0;
+    int err = 0, idx = 0;
+    
+    for ( ; GET_SIZE(HEAD(bp)) != 0; bp = NEXT_BLKP(bp))
+    {
+        if (bp+GET_SIZE(HEAD(bp)) > ar->heap_hi)
+            return check_fail(MM_CHECK_BLOCK,"block past the end of the heap",bp);
+        if ((err = checkblock(bp)) != 0)
+            return err;
+        if (GET_PREV_ALLOC(HEAD(bp)) != prev_alloc)
+            return check_fail(MM_CHECK_PREV,"PREV_ALLOC bit does not match the previous block",bp);
+        if (!GET_ALLOC(HEAD(bp)))
+        {
+            if (!prev_alloc)
+                return check_fail(MM_CHECK_COALESCE,"two free blocks side by side",bp);
+            nfree++;
+        }
+        prev_alloc = GET_ALLOC(HEAD(bp)) ? PREV_ALLOC : 0;
+    }
+    if (bp != ar->heap_hi || !GET_ALLOC(HEAD(bp)) || GET_PREV_ALLOC(HEAD(bp)) != prev_alloc)
+        return check_fail(MM_CHECK_BLOCK,"bad epilogue",bp);
     
+    // the blocks of a quick list are allocated heap blocks of its size
+    for (idx = 0; idx < QUICK_LISTS; idx++)
+    {
+        for (n = 0, bp = ar->quick[idx]; bp != NULL; bp = *(void **)bp)
+        {
+            if (bp < (char *)ar->heap_listp || bp >= ar->heap_hi || ((size_t)bp&(BLOCK_ALIGN-1)) != 0)
+                return check_fail(MM_CHECK_LIST,"quick list points out of the heap",bp);
+            if (!GET_ALLOC(HEAD(bp)) || GET_SIZE(HEAD(bp)) != MINSIZE+(size_t)idx*DSIZE)
+                return check_fail(MM_CHECK_LIST,"free block or other size in a quick list",bp);
+            if (++n > ar->quick_count[idx])
+                return check_fail(MM_CHECK_COUNT,"quick list longer than its count",bp);
+        }
+        if (n != ar->quick_count[idx])
+            return check_fail(MM_CHECK_COUNT,"quick list shorter than its count",ar->quick[idx]);
+    }
+    return check_index(ar,nfree);
 }
 
-// Check the whole heap
-static void mm_check()
+#ifndef MM_TLSF
+/*
+ * check_index - Walk free_tree in order: the sizes must grow, every child must link back to its parent,
+ * every same-size list must be doubly linked, and the tree must hold nfree blocks
+ */
+static int check_index(arena_t *ar,size_t nfree)
+{
+    void *node = NULL, *child = NULL, *bros = NULL, *prev = NULL;
+    size_t size = 0, last = 0, count = 0;
+    
+    for (node = find_fit(ar,0); node != NULL; node = tree_next(ar,node))
+    {
+        size = GET_SIZE(HEAD(node));
+        if (GET_ALLOC(HEAD(node)) || IS_LIST_NODE(node))
+            return check_fail(MM_CHECK_TREE,"allocated block or list node in free_tree",node);
+        if (size <= last)
+            return check_fail(MM_CHECK_TREE,"free_tree out of order",node);
+        last = size;
+        if (((child = GET_LEFT_CHILD(node)) != NULL && GET_PART(child) != node) ||
+            ((child = GET_RIGHT_CHILD(node)) != NULL && GET_PART(child) != node))
+            return check_fail(MM_CHECK_TREE,"child does not link back to its parent",child);
+        
+        for (prev = node, bros = GET_BROS(node); bros != NULL; prev = bros, bros = GET_BROS(bros))
+        {
+            if (!IS_LIST_NODE(bros) || GET_LEFT_CHILD(bros) != prev)
+                return check_fail(MM_CHECK_LIST,"same-size list does not link back",bros);
+            if (GET_ALLOC(HEAD(bros)) || GET_SIZE(HEAD(bros)) != size)
+                return check_fail(MM_CHECK_LIST,"allocated block or other size in a same-size list",bros);
+            if (++count > nfree)
+                return check_fail(MM_CHECK_COUNT,"more blocks in free_tree than free blocks",bros);
+        }
+        if (++count > nfree)
+            return check_fail(MM_CHECK_COUNT,"more blocks in free_tree than free blocks",node);
+    }
+    return (count == nfree) ? 0 : check_fail(MM_CHECK_COUNT,"free blocks missing from free_tree",ar->free_tree);
+}
+#else
+/*
+ * check_index - Every block must be in the list of its size, every list doubly linked and marked
+ * in the bitmaps when it is not empty, and the lists must hold nfree blocks
+ */
+static int check_index(arena_t *ar,size_t nfree)
 {
-    void *heap = 0;
-    heap = heap_listp;
-    while (1)
+    int fl = 0, sl = 0, bfl = 0, bsl = 0;
+    void *bp = NULL, *prev = NULL;
+    size_t count = 0;
+    
+    for (fl = 0; fl < FL_COUNT; fl++)
     {
-        printf("%p[%d|%d] --- %p[%d|%d]\n",HEAD(heap),GET_SIZE(HEAD(heap))\
-               ,GET_ALLOC(HEAD(heap)),FOOT(heap),GET_SIZE(HEAD(heap)),GET_ALLOC(HEAD(heap)));
-        heap = NEXT_BLKP(heap);
-		// When reach the end of the heap, then stop
-        if (GET_SIZE(HEAD(heap)) == 0 && GET_ALLOC(HEAD(heap)) == 1)
+        if (!(ar->fl_bitmap&(1U<<fl)) != (ar->sl_bitmap[fl] == 0))
+            return check_fail(MM_CHECK_TREE,"fl_bitmap does not match sl_bitmap",NULL);
+        for (sl = 0; sl < SL_COUNT; sl++)
         {
-            printf("\n");
-            break;
-        }  
-    }  
-}
\ No newline at end of file
+            if (!(ar->sl_bitmap[fl]&(1U<<sl)) != (ar->free_lists[fl][sl] == NULL))
+                return check_fail(MM_CHECK_TREE,"sl_bitmap does not match the list",ar->free_lists[fl][sl]);
+            for (prev = NULL, bp = ar->free_lists[fl][sl]; bp != NULL; prev = bp, bp = GET_NEXT_FREE(bp))
+            {
+                tlsf_mapping(GET_SIZE(HEAD(bp)),&bfl,&bsl);
+                if (GET_ALLOC(HEAD(bp)) || bfl != fl || bsl != sl)
+                    return check_fail(MM_CHECK_TREE,"allocated block or block in the wrong list",bp);
+                if (GET_PREV_FREE(bp) != prev)
+                    return check_fail(MM_CHECK_LIST,"free list does not link back",bp);
+                if (++count > nfree)
+                    return check_fail(MM_CHECK_COUNT,"more blocks in the lists than free blocks",bp);
+            }
+        }
+    }
+    return (count == nfree) ? 0 : check_fail(MM_CHECK_COUNT,"free blocks missing from the lists",NULL);
+}
+#endif
@@ -0,0 +1,84 @@
+/*
+ * malloc_new.cc
+ *  The C++ allocation operators on top of mm_malloc and mm_free.
+ *  Built with -DMM_PRELOAD into the LD_PRELOAD shim, new allocates through the malloc of the shim.
+ *  The sized forms of delete pass the size on to mm_free_sized, so a small object goes back
+ *  to the thread cache without reading any header.
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+extern "C" {
+void *mm_malloc (size_t size);
+void mm_free (void *bp);
+void mm_free_sized (void *bp,size_t size);
+}
+
+// In the LD_PRELOAD shim (malloc_preload.c) new goes through its malloc,
+// which sets the heap up on the first call and keeps the 16 bytes alignment of the C library
+#ifdef MM_PRELOAD
+#define NEW_MALLOC(size) malloc(size)
+#else
+#define NEW_MALLOC(size) mm_malloc(size)
+#endif
+
+/*
+ * operator new - Allocate with mm_malloc, throw std::bad_alloc when it fails
+ */
+void *operator new(std::size_t size)
+{
+    void *bp = NEW_MALLOC(size ? size : 1);// mm_malloc refuses 0 bytes, new must not
+    
+    if (bp == NULL)
+        throw std::bad_alloc();
+    return bp;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size,const std::nothrow_t &) noexcept
+{
+    return NEW_MALLOC(size ? size : 1);
+}
+
+void *operator new[](std::size_t size,const std::nothrow_t &) noexcept
+{
+    return NEW_MALLOC(size ? size : 1);
+}
+
+void operator delete(void *bp) noexcept
+{
+    mm_free(bp);
+}
+
+void operator delete[](void *bp) noexcept
+{
+    mm_free(bp);
+}
+
+/*
+ * operator delete - Sized delete, the size is the one given to new (1 for 0)
+ */
+void operator delete(void *bp,std::size_t size) noexcept
+{
+    mm_free_sized(bp,size ? size : 1);
+}
+
+void operator delete[](void *bp,std::size_t size) noexcept
+{
+    mm_free_sized(bp,size ? size : 1);
+}
+
+void operator delete(void *bp,const std::nothrow_t &) noexcept
+{
+    mm_free(bp);
+}
+
+void operator delete[](void *bp,const std::nothrow_t &) noexcept
+{
+    mm_free(bp);
+}
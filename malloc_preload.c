@@ -0,0 +1,189 @@
+/*
+ * malloc_preload.c
+ *	The malloc family of the C library on top of mm_malloc, mm_free and mm_realloc, built into libmm.so
+ *	so a program can run on this allocator without relinking:
+ *		LD_PRELOAD=./libmm.so program
+ *
+ *	The heap is set up by the first call of any of these functions; then the allocator is registered with
+ *	pthread_atfork, so a child never starts with one of its locks held by a thread it does not have.
+ *	mem_sbrk is not the malloc lab memlib here but reserves MAIN_HEAP bytes of address space
+ *	with mem_reserve (one PROT_NONE mmap) on its first call and moves a break inside it, committing
+ *	the pages it reaches with mprotect (whole huge pages under MM_THP); the kernel only backs the pages
+ *	which are touched, and they are 0 as MEM_SBRK_ZERO says.
+ *
+ *	glibc returns 16 bytes aligned blocks on x86-64 (and new does too), and some programs rely on it.
+ *	Slab objects and mapped blocks are 16 bytes aligned, and built with MM_PRELOAD malloc.c rounds heap blocks
+ *	to 16 bytes (BLOCK_ALIGN) from a 16 bytes aligned heap, so every block is returned as the allocator gives it.
+ *	libmm.so is built with -fvisibility=hidden: only the functions marked EXPORT are seen by the program.
+ *
+ *	Nothing here may call a function which allocates: it would come back into malloc.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAIN_HEAP ((size_t)1<<34)// the links of a heap reach 16GB
+#define MIN_HEAP ((size_t)1<<30)// a smaller address space is tried down to this
+
+#define EXPORT __attribute__((visibility("default")))
+
+static char *heap_start = NULL;// the region of mem_sbrk
+static char *heap_brk = NULL;
+static char *heap_commit = NULL;// end of the readable and writable pages
+static char *heap_max = NULL;
+
+static int mm_ready = 0;// read and written with __atomic
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * mem_sbrk - Grow the main heap by incr bytes, reserving its region on the first call.
+ * Only called under the lock of main_arena
+ */
+void *mem_sbrk(int incr)
+{
+    size_t len = 0, page = MEM_COMMIT_UNIT((size_t)sysconf(_SC_PAGESIZE));
+    char *old = NULL, *commit = NULL;
+    void *p = MAP_FAILED;
+
+    if (heap_start == NULL)
+    {
+        for (len = MAIN_HEAP; len >= MIN_HEAP; len >>= 1)
+            if ((p = mem_reserve(len,page)) != MAP_FAILED)
+                break;
+        if (p == MAP_FAILED)
+        {
+            errno = ENOMEM;
+            return (void *)-1;
+        }
+        heap_start = heap_brk = heap_commit = p;
+        heap_max = heap_start+len;
+    }
+    if (incr < 0 || (size_t)incr > (size_t)(heap_max-heap_brk))
+    {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    if (heap_brk+incr > heap_commit)
+    {
+        commit = (char *)(((uintptr_t)heap_brk+incr+page-1)&~(uintptr_t)(page-1));
+        if (mprotect(heap_commit,commit-heap_commit,PROT_READ|PROT_WRITE) != 0)
+            return (void *)-1;// errno is ENOMEM
+        heap_commit = commit;
+    }
+    old = heap_brk;
+    heap_brk += incr;
+    return old;
+}
+
+/*
+ * preload_init - Set the heap up once, whichever thread comes first, and register the fork handlers.
+ * pthread_atfork may allocate, so it is called once the heap is ready and the lock is released
+ */
+static void preload_init()
+{
+    static const char msg[] = "libmm: mm_init failed\n";
+    int first = 0;
+
+    pthread_mutex_lock(&init_lock);
+    if (!__atomic_load_n(&mm_ready,__ATOMIC_RELAXED))
+    {
+        if (mm_init() < 0)
+        {
+            if (write(STDERR_FILENO,msg,sizeof(msg)-1) < 0)
+                ;
+            abort();
+        }
+        __atomic_store_n(&mm_ready,1,__ATOMIC_RELEASE);
+        first = 1;
+    }
+    pthread_mutex_unlock(&init_lock);
+    if (first)
+        pthread_atfork(mm_fork_prepare,mm_fork_parent,mm_fork_child);
+}
+
+#define READY() do { \
+        if (!__atomic_load_n(&mm_ready,__ATOMIC_ACQUIRE)) \
+            preload_init(); \
+    } while (0)
+
+EXPORT void *malloc(size_t size)
+{
+    READY();
+    return mm_malloc(size ? size : 1);// mm_malloc refuses 0 bytes, malloc gives a block that can be freed
+}
+
+EXPORT void free(void *ptr)
+{
+    mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb,size_t size)
+{
+    READY();
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    return mm_calloc(nmemb,size);
+}
+
+EXPORT void *realloc(void *ptr,size_t size)
+{
+    READY();
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0)
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+    return mm_realloc(ptr,size);
+}
+
+EXPORT void *reallocarray(void *ptr,size_t nmemb,size_t size)
+{
+    if (size != 0 && nmemb > (size_t)-1/size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr,nmemb*size);
+}
+
+EXPORT int posix_memalign(void **memptr,size_t alignment,size_t size)
+{
+    READY();
+    return mm_posix_memalign(memptr,alignment,size ? size : 1);
+}
+
+EXPORT void *aligned_alloc(size_t alignment,size_t size)
+{
+    READY();
+    return mm_aligned_alloc(alignment,size ? size : 1);
+}
+
+EXPORT void *memalign(size_t alignment,size_t size)
+{
+    READY();
+    return mm_memalign(alignment,size ? size : 1);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign((size_t)sysconf(_SC_PAGESIZE),size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    return memalign(page,(size+page-1)&~(page-1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    return mm_usable_size(ptr);
+}
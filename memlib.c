@@ -0,0 +1,123 @@
+/*
+ * memlib.c
+ *	A stand-in for the memory system of the malloc lab, so the allocator can be built and measured alone.
+ *	mem_init reserves MAX_HEAP bytes of address space with mem_reserve (a PROT_NONE mmap), and mem_sbrk
+ *	moves the break inside it, committing the pages it reaches with mprotect (whole huge pages under MM_THP);
+ *	the pages are only backed when they are touched. mem_reset_brk gives the pages back with madvise(MADV_DONTNEED)
+ *	and decommits them, so they read as 0 again and a new mm_init starts from a fresh, zeroed heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "memlib.h"
+
+#define MAX_HEAP ((size_t)1<<32)  // 4GB of address space for the heap
+
+static char *mem_start_brk = NULL;  // first byte of the heap
+static char *mem_brk = NULL;        // first byte after the heap
+static char *mem_commit = NULL;     // end of the readable and writable pages
+static char *mem_max_addr = NULL;   // end of the reserved region
+
+/*
+ * mem_init - Reserve the region of the heap, exit when it cannot be mapped
+ */
+void mem_init(void)
+{
+    void *p = mem_reserve(MAX_HEAP,(size_t)getpagesize());
+    
+    if (p == MAP_FAILED)
+    {
+        perror("mem_init: mmap");
+        exit(1);
+    }
+    mem_start_brk = p;
+    mem_brk = mem_commit = mem_start_brk;
+    mem_max_addr = mem_start_brk+MAX_HEAP;
+}
+
+/*
+ * mem_deinit - Unmap the region of the heap
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk,MAX_HEAP);
+    mem_start_brk = mem_brk = mem_commit = mem_max_addr = NULL;
+}
+
+/*
+ * mem_reset_brk - Empty the heap and give its pages back, so it reads as 0 again
+ */
+void mem_reset_brk(void)
+{
+    if (mem_commit > mem_start_brk)
+    {
+        madvise(mem_start_brk,mem_commit-mem_start_brk,MADV_DONTNEED);
+        mprotect(mem_start_brk,mem_commit-mem_start_brk,PROT_NONE);
+    }
+    mem_brk = mem_commit = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - Grow the heap by incr bytes and return the start of the new area,
+ * or (void *)-1 with errno ENOMEM. The heap cannot shrink
+ */
+void *mem_sbrk(int incr)
+{
+    char *old_brk = mem_brk;
+    char *commit = NULL;
+    size_t page = MEM_COMMIT_UNIT((size_t)getpagesize());
+    
+    if (incr < 0 || (size_t)incr > (size_t)(mem_max_addr-mem_brk))
+    {
+        errno = ENOMEM;
+        fprintf(stderr,"ERROR: mem_sbrk failed. Ran out of memory...\n");
+        return (void *)-1;
+    }
+    if (mem_brk+incr > mem_commit)
+    {
+        commit = (char *)(((uintptr_t)mem_brk+incr+page-1)&~(uintptr_t)(page-1));
+        if (mprotect(mem_commit,commit-mem_commit,PROT_READ|PROT_WRITE) != 0)
+        {
+            fprintf(stderr,"ERROR: mem_sbrk failed. Cannot commit the pages...\n");
+            return (void *)-1;
+        }
+        mem_commit = commit;
+    }
+    mem_brk += incr;
+    return old_brk;
+}
+
+/*
+ * mem_heap_lo - Address of the first heap byte
+ */
+void *mem_heap_lo(void)
+{
+    return mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - Address of the last heap byte
+ */
+void *mem_heap_hi(void)
+{
+    return mem_brk-1;
+}
+
+/*
+ * mem_heapsize - Size of the heap in bytes
+ */
+size_t mem_heapsize(void)
+{
+    return (size_t)(mem_brk-mem_start_brk);
+}
+
+/*
+ * mem_pagesize - Size of a system page in bytes
+ */
+size_t mem_pagesize(void)
+{
+    return (size_t)getpagesize();
+}
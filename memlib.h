@@ -0,0 +1,68 @@
+/*
+ * memlib.h
+ *	The memory system the allocator grows its main heap from: mem_sbrk hands out
+ *	consecutive bytes of one region reserved by mem_init, like sbrk does with the data segment.
+ *	mem_reserve maps that region, and the regions of the other arenas, the same way.
+ */
+#include <unistd.h>
+#include <sys/mman.h>
+
+// The region is an anonymous mapping, so the bytes mem_sbrk hands out are always 0,
+// also after mem_reset_brk decommits them
+#define MEM_SBRK_ZERO 1
+
+// Built with -DMM_THP the heap regions are backed with 2MB transparent huge pages, and their pages are
+// committed and purged by whole huge pages so a huge page is never split. With -DMM_HUGETLB too,
+// a kernel without transparent huge pages gets the regions from the hugetlb pool instead
+// (vm.nr_hugepages), which must then hold enough pages for the heap
+#ifdef MM_THP
+#define MEM_HUGE_PAGE ((size_t)2<<20)
+#define MEM_COMMIT_UNIT(page) MEM_HUGE_PAGE
+#else
+#define MEM_COMMIT_UNIT(page) (page)
+#endif
+
+/*
+ * mem_reserve - Reserve len bytes of PROT_NONE address space aligned to align (a power of 2 of at least a page,
+ * raised to MEM_HUGE_PAGE under MM_THP), advised MADV_HUGEPAGE under MM_THP
+ * return MAP_FAILED when the space cannot be mapped
+ */
+static inline void *mem_reserve(size_t len,size_t align)
+{
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+    char *p = NULL;
+    size_t lead = 0;
+    
+#ifdef MM_THP
+    if (align < MEM_HUGE_PAGE)
+        align = MEM_HUGE_PAGE;
+#endif
+    // map align more and keep the aligned part
+    if ((p = mmap(NULL,len+align,PROT_NONE,flags,-1,0)) == MAP_FAILED)
+        return MAP_FAILED;
+#if defined(MM_THP) && defined(MM_HUGETLB)
+    // a kernel without transparent huge pages refuses the advice
+    if (madvise(p,len+align,MADV_HUGEPAGE) != 0)
+    {
+        munmap(p,len+align);
+        if ((p = mmap(NULL,len+align,PROT_NONE,flags|MAP_HUGETLB,-1,0)) == MAP_FAILED)
+            return MAP_FAILED;
+    }
+#elif defined(MM_THP)
+    madvise(p,len+align,MADV_HUGEPAGE);
+#endif
+    lead = (align-((size_t)p&(align-1)))&(align-1);
+    if (lead != 0)
+        munmap(p,lead);
+    munmap(p+lead+len,align-lead);
+    return p+lead;
+}
+
+extern void mem_init(void);
+extern void mem_deinit(void);
+extern void *mem_sbrk(int incr);
+extern void mem_reset_brk(void);
+extern void *mem_heap_lo(void);
+extern void *mem_heap_hi(void);
+extern size_t mem_heapsize(void);
+extern size_t mem_pagesize(void);
@@ -0,0 +1,80 @@
+#include <stdio.h>
+
+extern int mm_init (void);
+extern void *mm_malloc (size_t size);
+extern void mm_free (void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc (size_t nmemb, size_t size);
+
+extern void mm_free_sized (void *ptr, size_t size);
+extern size_t mm_malloc_batch (size_t size, size_t n, void **out);
+extern void mm_free_batch (void **ptrs, size_t n);
+extern void *mm_memalign (size_t alignment, size_t size);
+extern int mm_posix_memalign (void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc (size_t alignment, size_t size);
+
+extern size_t mm_usable_size (void *ptr);
+extern void *mm_malloc_at_least (size_t size, size_t *actual);
+
+extern void mm_fork_prepare (void);
+extern void mm_fork_parent (void);
+extern void mm_fork_child (void);
+
+extern void mm_set_mmap_threshold (size_t size);
+extern void mm_set_purge_decay (long ms);
+extern void mm_set_arenas (int n);
+
+/*
+ * Snapshot filled by mm_stats. Sizes are in bytes and count block headers.
+ */
+#define MM_STATS_BINS 32
+
+typedef struct {
+    size_t in_use;              /* heap_in_use + slab_in_use + mmap_size */
+    size_t heap_size;           /* heaps of all arenas */
+    size_t heap_in_use;         /* heap_size - free_bytes - quick_bytes */
+    size_t slab_size;           /* slabs carved from the slab region */
+    size_t slab_in_use;         /* allocated slab objects, thread caches included */
+    size_t mmap_size;           /* mappings of large blocks */
+    size_t mmap_count;
+    size_t free_bytes;          /* free heap blocks */
+    size_t free_blocks;
+    size_t quick_bytes;         /* freed heap blocks on the quick lists, not coalesced yet */
+    size_t free_by_class[MM_STATS_BINS]; /* free bytes in blocks of [2^i, 2^(i+1)) bytes */
+    size_t tree_nodes;          /* free_tree nodes, non-empty lists with MM_TLSF */
+    size_t largest_free;
+    double fragmentation;       /* 1 - largest_free / free_bytes */
+    size_t extend_heap_count;
+    size_t coalesce_count[4];   /* coalesce calls by case 1..4 */
+    size_t realloc_copy_bytes;  /* bytes mm_realloc copied when it could not resize in place */
+    size_t lock_contended;      /* arena and slab lock acquisitions which had to wait */
+} mm_stats_t;
+
+extern void mm_stats (mm_stats_t *st);
+
+/*
+ * Results of mm_checkheap, 0 when the heap is consistent
+ */
+#define MM_CHECK_BLOCK    -1  /* bad size, alignment, footer or epilogue */
+#define MM_CHECK_PREV     -2  /* PREV_ALLOC bit does not match the previous block */
+#define MM_CHECK_COALESCE -3  /* two free blocks side by side */
+#define MM_CHECK_TREE     -4  /* free_tree order or parent links, TLSF list or bitmaps */
+#define MM_CHECK_LIST     -5  /* same-size list links */
+#define MM_CHECK_COUNT    -6  /* free blocks and index entries differ */
+
+extern int mm_checkheap (void);
+
+/* 
+ * Students work in teams of one or two.  Teams enter their team name, 
+ * personal names and login IDs in a struct of this
+ * type in their bits.c file.
+ */
+typedef struct {
+    char *teamname; /* ID1+ID2 or ID1 */
+    char *name1;    /* full name of first member */
+    char *id1;      /* login ID of first member */
+    char *name2;    /* full name of second member (if any) */
+    char *id2;      /* login ID of second member */
+} team_t;
+
+extern team_t team;
@@ -0,0 +1,240 @@
+/*
+ * check.c
+ *	Regression checks of the allocator: each case runs on a fresh heap (mem_reset_brk, mm_init),
+ *	makes the calls which once went wrong and runs mm_checkheap after them.
+ *	The program prints one line per case and exits with 1 when any case fails.
+ *
+ *	usage: check
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define CROSS_BLOCKS 1000
+#define QUICK_THREADS 8
+#define QUICK_SLOTS 4096
+#define QUICK_OPS 200000
+
+#define EXPECT(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr,"%s:%d: %s\n",__FILE__,__LINE__,#cond); \
+            return -1; \
+        } \
+    } while (0)
+
+static void fresh_heap()
+{
+    mem_reset_brk();
+    if (mm_init() < 0)
+    {
+        fprintf(stderr,"check: mm_init failed\n");
+        exit(1);
+    }
+}
+
+// mm_malloc_batch takes a block from a quick list whose previous block is free
+static int batch_after_quick_free()
+{
+    void *a = mm_malloc(2000), *b = mm_malloc(600), *c = mm_malloc(2000);
+    void *out[8], *keep[8];
+    size_t i = 0;
+
+    EXPECT(a != NULL && b != NULL && c != NULL);
+    mm_free(a);
+    mm_free(b);// b goes on a quick list, after the free block a
+    EXPECT(mm_malloc_batch(600,1,out) == 1);
+    EXPECT(mm_checkheap() == 0);
+    memset(out[0],1,600);
+    mm_free_batch(out,1);
+    EXPECT(mm_checkheap() == 0);
+
+    // runs of several blocks after quick list frees of every size of the run
+    for (i = 0; i < 8; i++)
+        keep[i] = mm_malloc(600);
+    for (i = 0; i < 8; i += 2)
+        mm_free(keep[i]);
+    EXPECT(mm_malloc_batch(600,8,out) == 8);
+    EXPECT(mm_checkheap() == 0);
+    mm_free_batch(out,8);
+    for (i = 1; i < 8; i += 2)
+        mm_free(keep[i]);
+    mm_free(c);
+    EXPECT(mm_checkheap() == 0);
+    return 0;
+}
+
+// Allocate CROSS_BLOCKS heap blocks in the arena of a new thread, which exits
+static void *cross_alloc(void *arg)
+{
+    void **blocks = arg;
+    size_t i = 0;
+
+    for (i = 0; i < CROSS_BLOCKS; i++)
+        blocks[i] = mm_malloc(2000);
+    return NULL;
+}
+
+// Free the blocks from a thread which never allocated
+static void *cross_free(void *arg)
+{
+    void **blocks = arg;
+    size_t i = 0;
+
+    for (i = 0; i < CROSS_BLOCKS; i++)
+        mm_free(blocks[i]);
+    return NULL;
+}
+
+static size_t heap_in_use()
+{
+    mm_stats_t st;
+
+    mm_stats(&st);
+    return st.heap_in_use;
+}
+
+// Blocks freed by a thread of another arena, or by a thread with no arena yet, must not stay queued
+// when no thread allocates in their arena any more
+static int cross_arena_free()
+{
+    static void *blocks[CROSS_BLOCKS];
+    pthread_t tid;
+    size_t i = 0, base = 0;
+    void *p = NULL;
+
+    mm_set_arenas(2);
+    p = mm_malloc(2000);// this thread takes an arena
+    base = heap_in_use();
+
+    EXPECT(pthread_create(&tid,NULL,cross_alloc,blocks) == 0);
+    pthread_join(tid,NULL);
+    for (i = 0; i < CROSS_BLOCKS; i++)
+    {
+        EXPECT(blocks[i] != NULL);
+        mm_free(blocks[i]);
+    }
+    EXPECT(mm_checkheap() == 0);
+    EXPECT(heap_in_use() <= base+(64<<10));
+
+    for (i = 0; i < CROSS_BLOCKS; i++)
+        blocks[i] = mm_malloc(2000);
+    EXPECT(pthread_create(&tid,NULL,cross_free,blocks) == 0);
+    pthread_join(tid,NULL);
+    EXPECT(mm_checkheap() == 0);
+    EXPECT(heap_in_use() <= base+(64<<10));
+    mm_free(p);
+    return 0;
+}
+
+static void *quick_slots[QUICK_SLOTS];
+
+// Put blocks of quick list sizes in random slots shared by all the threads and free the block each replaces,
+// which mostly belongs to the arena of another thread
+static void *quick_cross(void *arg)
+{
+    unsigned int seed = (unsigned int)(size_t)arg;
+    size_t i = 0;
+    void *bp = NULL;
+
+    for (i = 0; i < QUICK_OPS; i++)
+    {
+        bp = mm_malloc(520+rand_r(&seed)%500);
+        if (bp == NULL)
+            return (void *)1;
+        bp = __atomic_exchange_n(&quick_slots[rand_r(&seed)%QUICK_SLOTS],bp,__ATOMIC_ACQ_REL);
+        mm_free(bp);
+    }
+    return NULL;
+}
+
+// Threads of several arenas free each other's quick list sized blocks at the same time,
+// so the remote queues fill while the owners free and flush their quick lists
+static int quick_cross_arena_free()
+{
+    pthread_t tid[QUICK_THREADS];
+    void *rc = NULL;
+    size_t i = 0;
+    int bad = 0;
+
+    mm_set_arenas(QUICK_THREADS);
+    for (i = 0; i < QUICK_THREADS; i++)
+        EXPECT(pthread_create(&tid[i],NULL,quick_cross,(void *)(i+1)) == 0);
+    for (i = 0; i < QUICK_THREADS; i++)
+    {
+        pthread_join(tid[i],&rc);
+        bad |= rc != NULL;
+    }
+    EXPECT(!bad);
+    EXPECT(mm_checkheap() == 0);
+    for (i = 0; i < QUICK_SLOTS; i++)
+    {
+        mm_free(quick_slots[i]);
+        quick_slots[i] = NULL;
+    }
+    EXPECT(mm_checkheap() == 0);
+    return 0;
+}
+
+// Every entry point returns NULL for 0 bytes and prints nothing
+static int zero_size()
+{
+    void *out[2] = { NULL, NULL };
+    size_t actual = 1;
+    char buf[64];
+    int fds[2], saved = -1, bad = 0;
+
+    EXPECT(pipe(fds) == 0);
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    dup2(fds[1],STDOUT_FILENO);
+    bad |= mm_malloc(0) != NULL;
+    bad |= mm_calloc(0,16) != NULL;
+    bad |= mm_calloc(16,0) != NULL;
+    bad |= mm_malloc_at_least(0,&actual) != NULL || actual != 0;
+    bad |= mm_malloc_batch(0,2,out) != 0;
+    bad |= mm_memalign(64,0) != NULL;
+    bad |= mm_memalign(8,0) != NULL;
+    bad |= mm_aligned_alloc(64,0) != NULL;
+    fflush(stdout);
+    dup2(saved,STDOUT_FILENO);
+    close(saved);
+    close(fds[1]);
+    EXPECT(!bad);
+    EXPECT(read(fds[0],buf,sizeof(buf)) == 0);
+    close(fds[0]);
+    EXPECT(mm_checkheap() == 0);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} cases[] = {
+    { "batch_after_quick_free", batch_after_quick_free },
+    { "cross_arena_free", cross_arena_free },
+    { "quick_cross_arena_free", quick_cross_arena_free },
+    { "zero_size", zero_size },
+};
+
+int main()
+{
+    size_t i = 0;
+    int failed = 0, rc = 0;
+
+    mem_init();
+    for (i = 0; i < sizeof(cases)/sizeof(cases[0]); i++)
+    {
+        fresh_heap();
+        rc = cases[i].run();
+        printf("%-32s %s\n",cases[i].name,(rc < 0) ? "FAILED" : "ok");
+        if (rc < 0)
+            failed = 1;
+    }
+    mem_deinit();
+    return failed;
+}